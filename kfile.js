@@ -3,10 +3,12 @@ let project = new Project('krass');
 project.useAsLibrary = () => {
 	project.debugDir = null;
     project.addExclude('tests/basic.c');
+    project.addExclude('tests/internal.c');
 };
 
 project.addFile('src/krass.c');
 project.addFile('tests/basic.c');
+project.addFile('tests/internal.c');
 project.addIncludeDir('src');
 project.setDebugDir('tests/bin');
 
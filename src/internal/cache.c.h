@@ -0,0 +1,163 @@
+#pragma once
+
+#include "pack.c.h"
+
+#include <kinc/io/filereader.h>
+#include <kinc/io/filewriter.h>
+#include <kinc/log.h>
+#include <krink/memory.h>
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define KRASS_CACHE_MAGIC 0x5353524bu
+#define KRASS_CACHE_FORMAT 1u
+#define KRASS_CACHE_SEED 0xcbf29ce484222325ull
+
+// File layout: header, rects, page sizes as float pairs, tightly packed RGBA rows of every page
+typedef struct krass_cache_header {
+	uint32_t magic;
+	uint32_t format;
+	uint64_t key;
+	// Rects are stored as is, a build with a different layout must not read them
+	uint32_t rect_size;
+	int32_t rect_count;
+	int32_t page_count;
+	uint32_t reserved;
+} krass_cache_header_t;
+
+typedef struct krass_cache {
+	uint8_t *file;
+	size_t size;
+	// Pixels of every page, pointing into `file`
+	uint8_t **pixels;
+	int page_count;
+} krass_cache_t;
+
+// FNV-1a, start with KRASS_CACHE_SEED and feed every part of the key
+static uint64_t krass_cache_hash(uint64_t hash, const void *data, size_t size) {
+	const uint8_t *bytes = (const uint8_t *)data;
+	for (size_t i = 0; i < size; ++i) {
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ull;
+	}
+	return hash;
+}
+
+static bool internal_cache_reject(krass_cache_t *cache, const char *reason) {
+#ifndef NDEBUG
+	kinc_log(KINC_LOG_LEVEL_INFO, "Ignoring texture cache: %s.", reason);
+#endif
+	(void)reason;
+	if (cache->file != NULL) kr_free(cache->file);
+	if (cache->pixels != NULL) kr_free(cache->pixels);
+	cache->file = NULL;
+	cache->pixels = NULL;
+	return false;
+}
+
+// Loads a cache file from the save directory. On success the canvas holds the cached layout and
+// `cache` must be released once the pixels were uploaded.
+static bool krass_cache_load(krass_cache_t *cache, const char *path, uint64_t key,
+                             krass_canvas_t *canvas) {
+	cache->file = NULL;
+	cache->pixels = NULL;
+	cache->page_count = 0;
+	cache->size = 0;
+	kinc_file_reader_t reader;
+	if (!kinc_file_reader_open(&reader, path, KINC_FILE_TYPE_SAVE))
+		return internal_cache_reject(cache, "no file");
+	size_t size = kinc_file_reader_size(&reader);
+	cache->file = (uint8_t *)kr_malloc(size > 0 ? size : 1);
+	assert(cache->file != NULL);
+	size_t read = kinc_file_reader_read(&reader, cache->file, size);
+	kinc_file_reader_close(&reader);
+	if (read != size || size < sizeof(krass_cache_header_t))
+		return internal_cache_reject(cache, "truncated");
+
+	krass_cache_header_t header;
+	memcpy(&header, cache->file, sizeof(krass_cache_header_t));
+	if (header.magic != KRASS_CACHE_MAGIC || header.format != KRASS_CACHE_FORMAT ||
+	    header.rect_size != sizeof(krass_rect_t))
+		return internal_cache_reject(cache, "incompatible format");
+	if (header.key != key || header.rect_count != canvas->top || header.page_count < 1)
+		return internal_cache_reject(cache, "stale");
+
+	size_t offset = sizeof(krass_cache_header_t);
+	size_t rects = offset;
+	offset += header.rect_count * sizeof(krass_rect_t);
+	size_t sizes = offset;
+	offset += header.page_count * 2 * sizeof(float);
+	if (offset > size) return internal_cache_reject(cache, "truncated");
+	cache->pixels = (uint8_t **)kr_malloc(header.page_count * sizeof(uint8_t *));
+	assert(cache->pixels != NULL);
+	float *dims = (float *)kr_malloc(header.page_count * 2 * sizeof(float));
+	assert(dims != NULL);
+	memcpy(dims, cache->file + sizes, header.page_count * 2 * sizeof(float));
+	for (int i = 0; i < header.page_count; ++i) {
+		cache->pixels[i] = cache->file + offset;
+		offset += (size_t)dims[2 * i] * (size_t)dims[2 * i + 1] * 4;
+	}
+	if (offset != size) {
+		kr_free(dims);
+		return internal_cache_reject(cache, "truncated");
+	}
+	krass_pack_restore(canvas, (const krass_rect_t *)(cache->file + rects), dims,
+	                   header.page_count);
+	kr_free(dims);
+	cache->size = size;
+	cache->page_count = header.page_count;
+	return true;
+}
+
+static void krass_cache_release(krass_cache_t *cache) {
+	kr_free(cache->file);
+	kr_free(cache->pixels);
+	cache->file = NULL;
+	cache->pixels = NULL;
+}
+
+// Writes everything but the pixels, which follow page by page with krass_cache_write_rows
+static bool krass_cache_write_begin(kinc_file_writer_t *writer, const char *path, uint64_t key,
+                                    krass_canvas_t *canvas) {
+	if (!kinc_file_writer_open(writer, path)) {
+		kinc_log(KINC_LOG_LEVEL_WARNING, "Unable to write texture cache %s", path);
+		return false;
+	}
+	krass_cache_header_t header;
+	header.magic = KRASS_CACHE_MAGIC;
+	header.format = KRASS_CACHE_FORMAT;
+	header.key = key;
+	header.rect_size = sizeof(krass_rect_t);
+	header.rect_count = canvas->top;
+	header.page_count = canvas->page_count;
+	header.reserved = 0;
+	kinc_file_writer_write(writer, &header, sizeof(krass_cache_header_t));
+	// Copied field by field, the padding of the rects would make identical layouts differ
+	for (int i = 0; i < canvas->top; ++i) {
+		const krass_rect_t *src = &canvas->rects[i];
+		krass_rect_t r;
+		memset(&r, 0, sizeof(krass_rect_t));
+		r.x = src->x;
+		r.y = src->y;
+		r.w = src->w;
+		r.h = src->h;
+		r.page = src->page;
+		r.rotatable = src->rotatable;
+		r.rotated = src->rotated;
+		kinc_file_writer_write(writer, &r, sizeof(krass_rect_t));
+	}
+	for (int i = 0; i < canvas->page_count; ++i) {
+		float dims[2] = {canvas->pages[i].w, canvas->pages[i].h};
+		kinc_file_writer_write(writer, dims, sizeof(dims));
+	}
+	return true;
+}
+
+// Appends `rows` rows of the current page, pages are written as a sequence of bands
+static void krass_cache_write_rows(kinc_file_writer_t *writer, uint8_t *pixels, int width,
+                                   int rows) {
+	kinc_file_writer_write(writer, pixels, width * rows * 4);
+}
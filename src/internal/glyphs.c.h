@@ -0,0 +1,354 @@
+#pragma once
+
+#include "pack.c.h"
+
+#include <krink/graphics2/ttf.h>
+#include <krink/memory.h>
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef KRASS_GLYPHS_FIRST
+// Codepoint of the first glyph krink bakes, the others follow without gaps
+#define KRASS_GLYPHS_FIRST 32u
+#endif
+#define KRASS_GLYPHS_LAST 0x10ffffu
+
+// Mirrors stbtt_bakedchar, the record krink keeps per glyph of every baked font size
+typedef struct krass_baked_char {
+	unsigned short x0, y0, x1, y1;
+	float xoff, yoff, xadvance;
+} krass_baked_char_t;
+
+// The glyph at (sx, sy) in the texture krink baked it into moves to (x, y) in the block of its font
+typedef struct krass_glyph {
+	int sx, sy, w, h;
+	int x, y;
+} krass_glyph_t;
+
+// Codepoints of a font subset as sorted, disjoint pairs of first and last codepoint
+typedef struct krass_glyph_set {
+	uint32_t *ranges;
+	int count;
+} krass_glyph_set_t;
+
+static int internal_glyphs_compare(const void *a, const void *b) {
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+// Sorts and merges `count` pairs in place, returns the number of pairs left
+static int internal_glyphs_merge(uint32_t *ranges, int count) {
+	qsort(ranges, count, 2 * sizeof(uint32_t), internal_glyphs_compare);
+	int top = 0;
+	for (int i = 0; i < count; ++i) {
+		uint32_t first = ranges[2 * i];
+		uint32_t last = ranges[2 * i + 1];
+		if (last > KRASS_GLYPHS_LAST) last = KRASS_GLYPHS_LAST;
+		if (first > last) continue;
+		if (top > 0 && first <= ranges[2 * top - 1] + 1) {
+			if (last > ranges[2 * top - 1]) ranges[2 * top - 1] = last;
+			continue;
+		}
+		ranges[2 * top] = first;
+		ranges[2 * top + 1] = last;
+		++top;
+	}
+	return top;
+}
+
+// Decodes one UTF-8 sequence, malformed bytes decode to U+FFFD
+static const char *internal_glyphs_decode(const char *text, uint32_t *codepoint) {
+	const unsigned char *s = (const unsigned char *)text;
+	int extra = s[0] < 0x80 ? 0 : s[0] >= 0xf0 ? 3 : s[0] >= 0xe0 ? 2 : s[0] >= 0xc0 ? 1 : -1;
+	if (extra < 0 || s[0] >= 0xf8) {
+		*codepoint = 0xfffd;
+		return text + 1;
+	}
+	uint32_t c = extra == 0 ? s[0] : s[0] & (0x3f >> extra);
+	for (int i = 1; i <= extra; ++i) {
+		if ((s[i] & 0xc0) != 0x80) {
+			*codepoint = 0xfffd;
+			return text + i;
+		}
+		c = (c << 6) | (s[i] & 0x3f);
+	}
+	*codepoint = c;
+	return text + 1 + extra;
+}
+
+// `count` pairs of first and last codepoint, inclusive
+static void krass_glyphs_set_ranges(krass_glyph_set_t *set, const uint32_t *ranges, int count) {
+	set->ranges = (uint32_t *)kr_malloc((count > 0 ? count : 1) * 2 * sizeof(uint32_t));
+	assert(set->ranges != NULL);
+	if (count > 0) memcpy(set->ranges, ranges, count * 2 * sizeof(uint32_t));
+	set->count = internal_glyphs_merge(set->ranges, count);
+}
+
+// Every codepoint of the UTF-8 `text`, except control characters like line breaks
+static void krass_glyphs_set_text(krass_glyph_set_t *set, const char *text) {
+	size_t len = strlen(text);
+	set->ranges = (uint32_t *)kr_malloc((len > 0 ? len : 1) * 2 * sizeof(uint32_t));
+	assert(set->ranges != NULL);
+	int count = 0;
+	while (*text != 0) {
+		text = internal_glyphs_decode(text, &set->ranges[2 * count]);
+		if (set->ranges[2 * count] < KRASS_GLYPHS_FIRST) continue;
+		set->ranges[2 * count + 1] = set->ranges[2 * count];
+		++count;
+	}
+	set->count = internal_glyphs_merge(set->ranges, count);
+}
+
+static bool internal_glyphs_contains(const krass_glyph_set_t *set, uint32_t codepoint) {
+	int lo = 0;
+	int hi = set->count;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (codepoint < set->ranges[2 * mid])
+			hi = mid;
+		else if (codepoint > set->ranges[2 * mid + 1])
+			lo = mid + 1;
+		else
+			return true;
+	}
+	return false;
+}
+
+// Number of codepoints in `set` that are not among `count` baked glyphs, the lowest in `first`
+static int krass_glyphs_missing(const krass_glyph_set_t *set, int count, uint32_t *first) {
+	int64_t end = (int64_t)KRASS_GLYPHS_FIRST + count;
+	int missing = 0;
+	for (int i = 0; i < set->count; ++i) {
+		int64_t lo = set->ranges[2 * i];
+		int64_t hi = (int64_t)set->ranges[2 * i + 1] + 1;
+		int64_t start = lo > KRASS_GLYPHS_FIRST ? lo : KRASS_GLYPHS_FIRST;
+		int64_t inside = (hi < end ? hi : end) - start;
+		int outside = (int)(hi - lo - (inside > 0 ? inside : 0));
+		if (missing == 0 && outside > 0) *first = (uint32_t)(start > lo || lo > end ? lo : end);
+		missing += outside;
+	}
+	return missing;
+}
+
+static krass_baked_char_t *internal_glyphs_chars(kr_ttf_font_t *font, int size) {
+	for (size_t i = 0; i < font->m_images_len; ++i) {
+		if (font->images[i].m_size == (float)size)
+			return (krass_baked_char_t *)font->images[i].chars;
+	}
+	return NULL;
+}
+
+// Packs the glyphs of a loaded font size as tightly as the atlas, dropping the padding and empty
+// margins of the texture krink baked them into. Returns the glyph count, the block they need is
+// `width` x `height`. Glyphs keep their baked positions if they do not fit into one page. Glyphs
+// missing from a non `NULL` `set` take no space and draw nothing. Every glyph gets `pad` empty
+// pixels around it, e.g. for the falloff of a distance field.
+static int krass_glyphs_layout(kr_ttf_font_t *font, int size, const krass_canvas_t *atlas,
+                               const krass_glyph_set_t *set, int pad, krass_glyph_t **glyphs,
+                               int *width, int *height) {
+	krass_baked_char_t *chars = internal_glyphs_chars(font, size);
+	assert(chars != NULL);
+	kr_ttf_aligned_quad_t quad;
+	int count = 0;
+	while (kr_ttf_get_baked_quad(font, size, &quad, count, 0.0f, 0.0f)) ++count;
+	*glyphs = (krass_glyph_t *)kr_malloc((count > 0 ? count : 1) * sizeof(krass_glyph_t));
+	assert(*glyphs != NULL);
+	krass_canvas_t canvas;
+	krass_pack_init(&canvas, count);
+	canvas.heuristic = atlas->heuristic;
+	canvas.sort = atlas->sort;
+	canvas.max_size = atlas->max_size;
+	// The block is cropped to the glyphs, the smallest canvas of any size fits best
+	canvas.npot = true;
+	for (int i = 0; i < count; ++i) {
+		krass_glyph_t *g = &(*glyphs)[i];
+		g->sx = chars[i].x0;
+		g->sy = chars[i].y0;
+		g->w = chars[i].x1 - chars[i].x0;
+		g->h = chars[i].y1 - chars[i].y0;
+		if (set != NULL && !internal_glyphs_contains(set, KRASS_GLYPHS_FIRST + (uint32_t)i)) {
+			g->w = 0;
+			g->h = 0;
+		}
+		// Pack id until the layout is done, empty glyphs take no space
+		g->x = g->w > 0 && g->h > 0
+		           ? krass_pack_add_rect(&canvas, g->w + 2 * pad, g->h + 2 * pad, false)
+		           : -1;
+	}
+	if (canvas.top > 0) krass_pack_compute(&canvas, 0.0);
+	bool packed = canvas.page_count == 1;
+	if (!packed && pad > 0)
+		kinc_log(KINC_LOG_LEVEL_WARNING, "Padded glyphs do not fit one page, they may overlap");
+	*width = 0;
+	*height = 0;
+	for (int i = 0; i < count; ++i) {
+		krass_glyph_t *g = &(*glyphs)[i];
+		if (g->x < 0) {
+			g->x = 0;
+			g->y = 0;
+			continue;
+		}
+		krass_rect_t *r = &canvas.rects[g->x];
+		g->x = (packed ? (int)r->x : g->sx) + pad;
+		g->y = (packed ? (int)r->y : g->sy) + pad;
+		if (g->x + g->w + pad > *width) *width = g->x + g->w + pad;
+		if (g->y + g->h + pad > *height) *height = g->y + g->h + pad;
+	}
+	krass_pack_destroy(&canvas);
+	return count;
+}
+
+// Points the baked chars of `font` at the glyphs of its block, which starts at (x, y) in the atlas.
+// Quads of glyphs laid out with `pad` include it
+static void krass_glyphs_map(kr_ttf_font_t *font, int size, const krass_glyph_t *glyphs,
+                             int count, int x, int y, int pad) {
+	krass_baked_char_t *chars = internal_glyphs_chars(font, size);
+	assert(chars != NULL);
+	for (int i = 0; i < count; ++i) {
+		int p = glyphs[i].w > 0 && glyphs[i].h > 0 ? pad : 0;
+		chars[i].x0 = (unsigned short)(x + glyphs[i].x - p);
+		chars[i].y0 = (unsigned short)(y + glyphs[i].y - p);
+		chars[i].x1 = (unsigned short)(chars[i].x0 + glyphs[i].w + 2 * p);
+		chars[i].y1 = (unsigned short)(chars[i].y0 + glyphs[i].h + 2 * p);
+		chars[i].xoff -= (float)p;
+		chars[i].yoff -= (float)p;
+	}
+}
+
+typedef enum krass_slot_state {
+	KRASS_SLOT_FREE,
+	KRASS_SLOT_QUEUED,
+	// Handed to the worker rasterizing glyphs
+	KRASS_SLOT_BUSY,
+	KRASS_SLOT_READY,
+	// The font does not have the glyph
+	KRASS_SLOT_MISSING,
+} krass_slot_state_t;
+
+// Slot of a glyph cache, linked into a list from the most to the least recently used one
+typedef struct krass_glyph_slot {
+	uint32_t codepoint;
+	krass_slot_state_t state;
+	krass_glyph_metrics_t metrics;
+	// Frame the glyph was last asked for, it is not evicted before the next one
+	unsigned frame;
+	int prev, next;
+} krass_glyph_slot_t;
+
+// Equally sized slots that glyphs are rasterized into on demand, a full cache evicts the least
+// recently used glyph
+typedef struct krass_glyph_slots {
+	krass_glyph_slot_t *slots;
+	int count;
+	int head, tail;
+	// Open addressing from codepoint to slot, -1 marks an empty bucket
+	int *table;
+	int mask;
+	unsigned frame;
+} krass_glyph_slots_t;
+
+static int internal_slots_home(const krass_glyph_slots_t *s, uint32_t codepoint) {
+	codepoint *= 0x9e3779b1u;
+	return (int)(codepoint ^ (codepoint >> 16)) & s->mask;
+}
+
+// Bucket holding `codepoint` or the empty one it would go into
+static int internal_slots_bucket(const krass_glyph_slots_t *s, uint32_t codepoint) {
+	int b = internal_slots_home(s, codepoint);
+	while (s->table[b] != -1 && s->slots[s->table[b]].codepoint != codepoint) b = (b + 1) & s->mask;
+	return b;
+}
+
+// Shifts later entries back into the emptied bucket, keeping every probe sequence intact
+static void internal_slots_erase(krass_glyph_slots_t *s, int bucket) {
+	int hole = bucket;
+	for (int b = (hole + 1) & s->mask; s->table[b] != -1; b = (b + 1) & s->mask) {
+		int home = internal_slots_home(s, s->slots[s->table[b]].codepoint);
+		if (((b - home) & s->mask) >= ((b - hole) & s->mask)) {
+			s->table[hole] = s->table[b];
+			hole = b;
+		}
+	}
+	s->table[hole] = -1;
+}
+
+static void internal_slots_unlink(krass_glyph_slots_t *s, int i) {
+	krass_glyph_slot_t *slot = &s->slots[i];
+	if (slot->prev > -1)
+		s->slots[slot->prev].next = slot->next;
+	else
+		s->head = slot->next;
+	if (slot->next > -1)
+		s->slots[slot->next].prev = slot->prev;
+	else
+		s->tail = slot->prev;
+}
+
+static void internal_slots_push_front(krass_glyph_slots_t *s, int i) {
+	s->slots[i].prev = -1;
+	s->slots[i].next = s->head;
+	if (s->head > -1) s->slots[s->head].prev = i;
+	s->head = i;
+	if (s->tail < 0) s->tail = i;
+}
+
+// Frees every slot
+static void krass_glyph_slots_clear(krass_glyph_slots_t *s) {
+	for (int i = 0; i < s->count; ++i) {
+		s->slots[i].codepoint = 0;
+		s->slots[i].state = KRASS_SLOT_FREE;
+		s->slots[i].prev = i - 1;
+		s->slots[i].next = i + 1 < s->count ? i + 1 : -1;
+	}
+	s->head = 0;
+	s->tail = s->count - 1;
+	for (int i = 0; i <= s->mask; ++i) s->table[i] = -1;
+}
+
+static void krass_glyph_slots_init(krass_glyph_slots_t *s, int count) {
+	int size = 2;
+	while (size < 2 * count) size <<= 1;
+	s->count = count;
+	s->mask = size - 1;
+	s->frame = 0;
+	s->slots = (krass_glyph_slot_t *)kr_malloc(count * sizeof(krass_glyph_slot_t));
+	assert(s->slots != NULL);
+	s->table = (int *)kr_malloc(size * sizeof(int));
+	assert(s->table != NULL);
+	krass_glyph_slots_clear(s);
+}
+
+static void krass_glyph_slots_destroy(krass_glyph_slots_t *s) {
+	kr_free(s->slots);
+	kr_free(s->table);
+	s->slots = NULL;
+	s->table = NULL;
+}
+
+// Slot of `codepoint`, a new glyph is queued in the least recently used one. Returns -1 if every
+// slot was asked for during the current frame
+static int krass_glyph_slots_acquire(krass_glyph_slots_t *s, uint32_t codepoint) {
+	int b = internal_slots_bucket(s, codepoint);
+	int i = s->table[b];
+	if (i < 0) {
+		i = s->tail;
+		krass_glyph_slot_t *slot = &s->slots[i];
+		if (slot->state != KRASS_SLOT_FREE) {
+			if (slot->frame == s->frame) return -1;
+			internal_slots_erase(s, internal_slots_bucket(s, slot->codepoint));
+			b = internal_slots_bucket(s, codepoint);
+		}
+		slot->codepoint = codepoint;
+		slot->state = KRASS_SLOT_QUEUED;
+		s->table[b] = i;
+	}
+	s->slots[i].frame = s->frame;
+	internal_slots_unlink(s, i);
+	internal_slots_push_front(s, i);
+	return i;
+}
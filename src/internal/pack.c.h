@@ -1,23 +1,74 @@
 #pragma once
 
+#include "../krass.h"
+
 #include <assert.h>
 #include <kinc/log.h>
+#include <kinc/system.h>
+#include <kinc/threads/mutex.h>
+#include <kinc/threads/thread.h>
 #include <krink/math/vector.h>
 #include <krink/memory.h>
+#include <float.h>
 #include <math.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 
 #define KRASS_MIN_FREE 5
+#define KRASS_NPOT_SAMPLES 4
+#define KRASS_MAX_SKEW 2
+
+// Set while packing trials run on worker threads, kr_malloc makes no thread safety guarantees
+static kinc_mutex_t *pack_alloc_mutex = NULL;
+
+static void *internal_pack_malloc(size_t size) {
+	if (pack_alloc_mutex != NULL) kinc_mutex_lock(pack_alloc_mutex);
+	void *mem = kr_malloc(size);
+	if (pack_alloc_mutex != NULL) kinc_mutex_unlock(pack_alloc_mutex);
+	return mem;
+}
+
+static void *internal_pack_realloc(void *mem, size_t size) {
+	if (pack_alloc_mutex != NULL) kinc_mutex_lock(pack_alloc_mutex);
+	mem = kr_realloc(mem, size);
+	if (pack_alloc_mutex != NULL) kinc_mutex_unlock(pack_alloc_mutex);
+	return mem;
+}
+
+static void internal_pack_free(void *mem) {
+	if (pack_alloc_mutex != NULL) kinc_mutex_lock(pack_alloc_mutex);
+	kr_free(mem);
+	if (pack_alloc_mutex != NULL) kinc_mutex_unlock(pack_alloc_mutex);
+}
 
 typedef struct krass_rect {
 	float x, y, w, h;
+	int page;
+	// `rotated` rects are stored a quarter turn clockwise, occupying h*w. `w` and `h` stay the
+	// unrotated size
+	bool rotatable, rotated;
 } krass_rect_t;
 
-typedef struct krass_canvas {
+typedef struct krass_page {
 	float w, h;
+	// Free space of the final layout, kept to place rects added after packing
+	struct krass_packer *packer;
+} krass_page_t;
+
+typedef struct krass_canvas {
+	krass_page_t *pages;
+	int page_count;
 	krass_rect_t *rects;
 	int top, cap;
+	krass_pack_heuristic_t heuristic;
+	krass_pack_sort_t sort;
+	float max_size;
+	unsigned trial_heuristics, trial_sorts;
+	int threads;
+	bool npot;
+	// At least one rect may be rotated
+	bool rotatable;
 	bool init;
 } krass_canvas_t;
 
@@ -28,7 +79,7 @@ typedef struct free_area {
 } free_area_t;
 
 static void internal_fa_init(free_area_t *a, float w, float h, int reserve) {
-	a->rects = (krass_rect_t *)kr_malloc(reserve * sizeof(krass_rect_t));
+	a->rects = (krass_rect_t *)internal_pack_malloc(reserve * sizeof(krass_rect_t));
 	assert(a->rects != NULL);
 	a->rects[0].x = 0.0f;
 	a->rects[0].y = 0.0f;
@@ -38,9 +89,16 @@ static void internal_fa_init(free_area_t *a, float w, float h, int reserve) {
 	a->cap = reserve;
 }
 
+static void internal_fa_init_empty(free_area_t *a, int reserve) {
+	a->rects = (krass_rect_t *)internal_pack_malloc(reserve * sizeof(krass_rect_t));
+	assert(a->rects != NULL);
+	a->top = 0;
+	a->cap = reserve;
+}
+
 static void internal_fa_destroy(free_area_t *a) {
 	assert(a->rects != NULL);
-	kr_free(a->rects);
+	internal_pack_free(a->rects);
 	a->top = 0;
 	a->cap = 0;
 }
@@ -48,18 +106,38 @@ static void internal_fa_destroy(free_area_t *a) {
 static void internal_fa_grow(free_area_t *a) {
 	if (a->top + 1 >= a->cap) {
 		if (a->cap > 0) {
-			a->rects = (krass_rect_t *)kr_realloc(a->rects, (a->cap * 2) * sizeof(krass_rect_t));
+			a->rects = (krass_rect_t *)internal_pack_realloc(a->rects,
+			                                                 (a->cap * 2) * sizeof(krass_rect_t));
 			assert(a->rects != NULL);
 			a->cap *= 2;
 		}
 		else {
-			a->rects = (krass_rect_t *)kr_malloc(2 * sizeof(krass_rect_t));
+			a->rects = (krass_rect_t *)internal_pack_malloc(2 * sizeof(krass_rect_t));
 			assert(a->rects != NULL);
 			a->cap = 2;
 		}
 	}
 }
 
+static void internal_fa_push(free_area_t *a, float x, float y, float w, float h) {
+	internal_fa_grow(a);
+	a->rects[a->top].x = x;
+	a->rects[a->top].y = y;
+	a->rects[a->top].w = w;
+	a->rects[a->top].h = h;
+	++a->top;
+}
+
+static void internal_fa_insert(free_area_t *a, int index, float x, float y, float w, float h) {
+	internal_fa_grow(a);
+	memmove(&a->rects[index + 1], &a->rects[index], (a->top - index) * sizeof(krass_rect_t));
+	a->rects[index].x = x;
+	a->rects[index].y = y;
+	a->rects[index].w = w;
+	a->rects[index].h = h;
+	++a->top;
+}
+
 static void internal_fa_shift_left(free_area_t *a, int first) {
 	for (int i = first; i < a->top - 1; ++i) {
 		memcpy(&a->rects[i], &a->rects[i + 1], sizeof(krass_rect_t));
@@ -99,7 +177,6 @@ static bool internal_fa_place(free_area_t *a, kr_vec2_t *pos, float w, float h)
 			else {
 				// Split into two
 				internal_fa_grow(a);
-				float prev_h = a->rects[current].h;
 				a->rects[current].y = re_bottom;
 				a->rects[current].h -= h + 1;
 				a->rects[a->top].x = re_right;
@@ -114,12 +191,317 @@ static bool internal_fa_place(free_area_t *a, kr_vec2_t *pos, float w, float h)
 	return false;
 }
 
+static bool internal_rect_contains(const krass_rect_t *a, const krass_rect_t *b) {
+	return b->x >= a->x && b->y >= a->y && b->x + b->w <= a->x + a->w &&
+	       b->y + b->h <= a->y + a->h;
+}
+
+static float internal_overlap(float a0, float a1, float b0, float b1) {
+	float lo = a0 > b0 ? a0 : b0;
+	float hi = a1 < b1 ? a1 : b1;
+	return hi > lo ? hi - lo : 0.0f;
+}
+
+typedef struct krass_packer {
+	krass_pack_heuristic_t heuristic;
+	float w, h;
+	// Turn rotatable rects when that fits better
+	bool rotate;
+	free_area_t free;
+	free_area_t used;
+	free_area_t skyline;
+} krass_packer_t;
+
+static bool internal_packer_is_skyline(krass_pack_heuristic_t heuristic) {
+	return heuristic == KRASS_PACK_SKYLINE_BOTTOM_LEFT || heuristic == KRASS_PACK_SKYLINE_MIN_WASTE;
+}
+
+static void internal_packer_init(krass_packer_t *p, krass_pack_heuristic_t heuristic, float w,
+                                 float h, int reserve) {
+	p->heuristic = heuristic;
+	p->w = w;
+	p->h = h;
+	p->rotate = true;
+	reserve = reserve > 1 ? reserve : 2;
+	memset(&p->used, 0, sizeof(free_area_t));
+	memset(&p->skyline, 0, sizeof(free_area_t));
+	if (internal_packer_is_skyline(heuristic)) {
+		// The free list only holds the waste map below the skyline, nodes use x, y and w
+		internal_fa_init_empty(&p->free, reserve);
+		internal_fa_init(&p->skyline, w, 0.0f, reserve);
+	}
+	else {
+		internal_fa_init(&p->free, w, h, reserve);
+		if (heuristic == KRASS_PACK_MAXRECTS_CONTACT_POINT)
+			internal_fa_init_empty(&p->used, reserve);
+	}
+}
+
+static void internal_packer_destroy(krass_packer_t *p) {
+	internal_fa_destroy(&p->free);
+	if (p->used.rects != NULL) internal_fa_destroy(&p->used);
+	if (p->skyline.rects != NULL) internal_fa_destroy(&p->skyline);
+}
+
+static float internal_mr_contact(krass_packer_t *p, float x, float y, float w, float h) {
+	float score = 0.0f;
+	if (x == 0.0f || x + w == p->w) score += h;
+	if (y == 0.0f || y + h == p->h) score += w;
+	for (int i = 0; i < p->used.top; ++i) {
+		krass_rect_t *u = &p->used.rects[i];
+		if (u->x == x + w || u->x + u->w == x)
+			score += internal_overlap(u->y, u->y + u->h, y, y + h);
+		if (u->y == y + h || u->y + u->h == y)
+			score += internal_overlap(u->x, u->x + u->w, x, x + w);
+	}
+	return score;
+}
+
+static void internal_mr_score(krass_packer_t *p, krass_rect_t *f, float w, float h, float *primary,
+                              float *secondary) {
+	float dw = f->w - w;
+	float dh = f->h - h;
+	float short_side = dw < dh ? dw : dh;
+	float long_side = dw > dh ? dw : dh;
+	switch (p->heuristic) {
+	case KRASS_PACK_MAXRECTS_BEST_LONG_SIDE:
+		*primary = long_side;
+		*secondary = short_side;
+		break;
+	case KRASS_PACK_MAXRECTS_BEST_AREA:
+		*primary = f->w * f->h - w * h;
+		*secondary = short_side;
+		break;
+	case KRASS_PACK_MAXRECTS_BOTTOM_LEFT:
+		*primary = f->y + h;
+		*secondary = f->x;
+		break;
+	case KRASS_PACK_MAXRECTS_CONTACT_POINT:
+		// Higher contact is better, negate to share the "lower wins" comparison
+		*primary = -internal_mr_contact(p, f->x, f->y, w, h);
+		*secondary = f->y;
+		break;
+	default:
+		*primary = short_side;
+		*secondary = long_side;
+		break;
+	}
+}
+
+static bool internal_mr_split(free_area_t *a, int i, const krass_rect_t *node) {
+	krass_rect_t f = a->rects[i];
+	if (node->x >= f.x + f.w || node->x + node->w <= f.x || node->y >= f.y + f.h ||
+	    node->y + node->h <= f.y)
+		return false;
+	if (node->y > f.y) internal_fa_push(a, f.x, f.y, f.w, node->y - f.y);
+	if (node->y + node->h < f.y + f.h)
+		internal_fa_push(a, f.x, node->y + node->h, f.w, f.y + f.h - (node->y + node->h));
+	if (node->x > f.x) internal_fa_push(a, f.x, f.y, node->x - f.x, f.h);
+	if (node->x + node->w < f.x + f.w)
+		internal_fa_push(a, node->x + node->w, f.y, f.x + f.w - (node->x + node->w), f.h);
+	return true;
+}
+
+static void internal_mr_prune(free_area_t *a, int first_new) {
+	// Only the rects produced by the last split can be redundant, everything before was already
+	// pruned against their parents.
+	for (int i = first_new; i < a->top; ++i) {
+		for (int j = 0; j < a->top; ++j) {
+			if (i == j) continue;
+			if (internal_rect_contains(&a->rects[j], &a->rects[i])) {
+				internal_fa_shift_left(a, i);
+				--i;
+				break;
+			}
+		}
+	}
+}
+
+static bool internal_mr_place(krass_packer_t *p, kr_vec2_t *pos, float w, float h, bool rotatable,
+                              bool *rotated) {
+	w = ceilf(w) + 1;
+	h = ceilf(h) + 1;
+	int turns = rotatable && w != h ? 2 : 1;
+	int best = -1;
+	bool best_rotated = false;
+	float best_primary = FLT_MAX;
+	float best_secondary = FLT_MAX;
+	for (int i = 0; i < p->free.top; ++i) {
+		krass_rect_t *f = &p->free.rects[i];
+		for (int turn = 0; turn < turns; ++turn) {
+			float rw = turn ? h : w;
+			float rh = turn ? w : h;
+			if (f->w < rw || f->h < rh) continue;
+			float primary, secondary;
+			internal_mr_score(p, f, rw, rh, &primary, &secondary);
+			if (primary < best_primary ||
+			    (primary == best_primary && secondary < best_secondary)) {
+				best = i;
+				best_rotated = turn == 1;
+				best_primary = primary;
+				best_secondary = secondary;
+			}
+		}
+	}
+	if (best < 0) return false;
+	*rotated = best_rotated;
+	if (best_rotated) {
+		float tmp = w;
+		w = h;
+		h = tmp;
+	}
+
+	krass_rect_t node = {p->free.rects[best].x, p->free.rects[best].y, w, h, 0, false, false};
+	int count = p->free.top;
+	for (int i = 0; i < count; ++i) {
+		if (internal_mr_split(&p->free, i, &node)) {
+			internal_fa_shift_left(&p->free, i);
+			--i;
+			--count;
+		}
+	}
+	internal_mr_prune(&p->free, count);
+	if (p->used.rects != NULL) internal_fa_push(&p->used, node.x, node.y, node.w, node.h);
+	pos->x = node.x;
+	pos->y = node.y;
+	return true;
+}
+
+static bool internal_sl_fit(krass_packer_t *p, int index, float w, float h, float *y,
+                            float *waste) {
+	krass_rect_t *nodes = p->skyline.rects;
+	float x = nodes[index].x;
+	if (x + w > p->w) return false;
+	float top = 0.0f;
+	for (int i = index; i < p->skyline.top && nodes[i].x < x + w; ++i) {
+		if (nodes[i].y > top) top = nodes[i].y;
+		if (top + h > p->h) return false;
+	}
+	*waste = 0.0f;
+	for (int i = index; i < p->skyline.top && nodes[i].x < x + w; ++i) {
+		float right = nodes[i].x + nodes[i].w < x + w ? nodes[i].x + nodes[i].w : x + w;
+		*waste += (right - nodes[i].x) * (top - nodes[i].y);
+	}
+	*y = top;
+	return true;
+}
+
+static void internal_sl_add_level(krass_packer_t *p, int index, float x, float y, float w,
+                                  float h) {
+	// Everything between the old skyline and the bottom of the new rect goes into the waste map
+	for (int i = index; i < p->skyline.top && p->skyline.rects[i].x < x + w; ++i) {
+		krass_rect_t *n = &p->skyline.rects[i];
+		float right = n->x + n->w < x + w ? n->x + n->w : x + w;
+		if (y > n->y) internal_fa_push(&p->free, n->x, n->y, right - n->x, y - n->y);
+	}
+
+	internal_fa_insert(&p->skyline, index, x, y + h, w, 0.0f);
+	krass_rect_t *nodes = p->skyline.rects;
+	for (int i = index + 1; i < p->skyline.top;) {
+		float shrink = nodes[index].x + nodes[index].w - nodes[i].x;
+		if (shrink <= 0.0f) break;
+		if (nodes[i].w <= shrink) {
+			internal_fa_shift_left(&p->skyline, i);
+			continue;
+		}
+		nodes[i].x += shrink;
+		nodes[i].w -= shrink;
+		break;
+	}
+	for (int i = 0; i < p->skyline.top - 1;) {
+		if (nodes[i].y == nodes[i + 1].y) {
+			nodes[i].w += nodes[i + 1].w;
+			internal_fa_shift_left(&p->skyline, i + 1);
+		}
+		else
+			++i;
+	}
+}
+
+// First fit into the guillotine free list, turning the rect only if it does not fit upright
+static bool internal_fa_place_rotatable(free_area_t *a, kr_vec2_t *pos, float w, float h,
+                                        bool rotatable, bool *rotated) {
+	*rotated = false;
+	if (internal_fa_place(a, pos, w, h)) return true;
+	if (!rotatable || ceilf(w) == ceilf(h) || !internal_fa_place(a, pos, h, w)) return false;
+	*rotated = true;
+	return true;
+}
+
+static bool internal_sl_place(krass_packer_t *p, kr_vec2_t *pos, float w, float h, bool rotatable,
+                              bool *rotated) {
+	if (internal_fa_place_rotatable(&p->free, pos, w, h, rotatable, rotated)) return true;
+	w = ceilf(w) + 1;
+	h = ceilf(h) + 1;
+	int turns = rotatable && w != h ? 2 : 1;
+	int best = -1;
+	bool best_rotated = false;
+	float best_primary = FLT_MAX;
+	float best_secondary = FLT_MAX;
+	float best_y = 0.0f;
+	for (int i = 0; i < p->skyline.top; ++i) {
+		for (int turn = 0; turn < turns; ++turn) {
+			float rw = turn ? h : w;
+			float rh = turn ? w : h;
+			float y, waste;
+			if (!internal_sl_fit(p, i, rw, rh, &y, &waste)) continue;
+			float primary = y + rh;
+			float secondary = p->skyline.rects[i].w;
+			if (p->heuristic == KRASS_PACK_SKYLINE_MIN_WASTE) {
+				secondary = primary;
+				primary = waste;
+			}
+			if (primary < best_primary ||
+			    (primary == best_primary && secondary < best_secondary)) {
+				best = i;
+				best_rotated = turn == 1;
+				best_primary = primary;
+				best_secondary = secondary;
+				best_y = y;
+			}
+		}
+	}
+	if (best < 0) return false;
+	*rotated = best_rotated;
+	pos->x = p->skyline.rects[best].x;
+	pos->y = best_y;
+	if (best_rotated)
+		internal_sl_add_level(p, best, pos->x, pos->y, h, w);
+	else
+		internal_sl_add_level(p, best, pos->x, pos->y, w, h);
+	return true;
+}
+
+// Position and orientation of a rect inside a candidate layout
+typedef struct pack_place {
+	kr_vec2_t pos;
+	bool rotated;
+} pack_place_t;
+
+static bool internal_packer_place(krass_packer_t *p, pack_place_t *place, const krass_rect_t *r) {
+	bool rotatable = p->rotate && r->rotatable;
+	if (p->heuristic == KRASS_PACK_GUILLOTINE_FIRST_FIT)
+		return internal_fa_place_rotatable(&p->free, &place->pos, r->w, r->h, rotatable,
+		                                   &place->rotated);
+	if (internal_packer_is_skyline(p->heuristic))
+		return internal_sl_place(p, &place->pos, r->w, r->h, rotatable, &place->rotated);
+	return internal_mr_place(p, &place->pos, r->w, r->h, rotatable, &place->rotated);
+}
+
 static void krass_pack_init(krass_canvas_t *canvas, int reserve) {
 	assert(reserve >= 0);
-	canvas->w = 0;
-	canvas->h = 0;
+	canvas->pages = NULL;
+	canvas->page_count = 0;
 	canvas->top = 0;
 	canvas->cap = reserve;
+	canvas->heuristic = KRASS_PACK_MAXRECTS_BEST_SHORT_SIDE;
+	canvas->sort = KRASS_PACK_SORT_HEIGHT;
+	canvas->max_size = 16384.0f;
+	canvas->trial_heuristics = 0;
+	canvas->trial_sorts = 0;
+	canvas->threads = 1;
+	canvas->npot = false;
+	canvas->rotatable = false;
 	if (reserve > 0) {
 		canvas->rects = (krass_rect_t *)kr_malloc(reserve * sizeof(krass_rect_t));
 		assert(canvas->rects != NULL);
@@ -130,24 +512,41 @@ static void krass_pack_init(krass_canvas_t *canvas, int reserve) {
 	canvas->init = true;
 }
 
+static void internal_release_pages(krass_canvas_t *canvas) {
+	for (int i = 0; i < canvas->page_count; ++i) {
+		if (canvas->pages[i].packer == NULL) continue;
+		internal_packer_destroy(canvas->pages[i].packer);
+		kr_free(canvas->pages[i].packer);
+	}
+	if (canvas->pages != NULL) kr_free(canvas->pages);
+	canvas->pages = NULL;
+	canvas->page_count = 0;
+}
+
 static void krass_pack_destroy(krass_canvas_t *canvas) {
+	internal_release_pages(canvas);
 	if (canvas->rects != NULL) kr_free(canvas->rects);
 	canvas->init = false;
 }
 
-static int krass_pack_add_rect(krass_canvas_t *canvas, float w, float h) {
+// `rotatable` lets the packer store the rect a quarter turn clockwise when that fits better
+static int krass_pack_add_rect(krass_canvas_t *canvas, float w, float h, bool rotatable) {
 	assert(canvas->init);
 	if (canvas->top == canvas->cap) {
+		canvas->cap = canvas->cap > 0 ? canvas->cap * 2 : 2;
 		canvas->rects =
 		    (krass_rect_t *)kr_realloc(canvas->rects, canvas->cap * sizeof(krass_rect_t));
 		assert(canvas->rects != NULL);
-		canvas->cap *= 2;
 	}
 	krass_rect_t *dest = &canvas->rects[canvas->top++];
 	dest->x = 0.0f;
 	dest->y = 0.0f;
 	dest->w = w;
 	dest->h = h;
+	dest->page = 0;
+	dest->rotatable = rotatable;
+	dest->rotated = false;
+	canvas->rotatable = canvas->rotatable || rotatable;
 	return canvas->top - 1;
 }
 
@@ -157,74 +556,659 @@ static bool internal_is_in(int a, int *values, int count) {
 	return false;
 }
 
-static void internal_sort_by_height(krass_canvas_t *canvas, int *ids) {
-	for (int i = 0; i < canvas->top; ++i) ids[i] = i;
-	for (int i = 0; i < canvas->top - 1; ++i) {
-		for (int j = i + 1; j < canvas->top; ++j) {
-			if (canvas->rects[ids[j]].h > canvas->rects[ids[i]].h) {
-				int tmp = ids[i];
-				ids[i] = ids[j];
-				ids[j] = tmp;
-			}
+static uint64_t internal_sort_key(krass_pack_sort_t sort, const krass_rect_t *r) {
+	uint64_t w = (uint64_t)ceilf(r->w);
+	uint64_t h = (uint64_t)ceilf(r->h);
+	switch (sort) {
+	case KRASS_PACK_SORT_WIDTH:
+		return w;
+	case KRASS_PACK_SORT_AREA:
+		return w * h;
+	case KRASS_PACK_SORT_PERIMETER:
+		return w + h;
+	case KRASS_PACK_SORT_MAX_SIDE:
+		return w > h ? w : h;
+	case KRASS_PACK_SORT_HEIGHT_WIDTH:
+		return (h << 32) | w;
+	default:
+		return h;
+	}
+}
+
+// Stable LSD radix sort, largest key first. Passes where every key shares the same digit are
+// skipped, so the common small dimensions only cost two or three passes.
+static void internal_sort(krass_canvas_t *canvas, krass_pack_sort_t sort, int *ids) {
+	int n = canvas->top;
+	if (n == 0) return;
+	uint64_t *keys = (uint64_t *)internal_pack_malloc(2 * n * sizeof(uint64_t));
+	assert(keys != NULL);
+	int *tmp = (int *)internal_pack_malloc(n * sizeof(int));
+	assert(tmp != NULL);
+	for (int i = 0; i < n; ++i) {
+		ids[i] = i;
+		keys[i] = ~internal_sort_key(sort, &canvas->rects[i]);
+	}
+	uint64_t *src_keys = keys;
+	uint64_t *dst_keys = keys + n;
+	int *src_ids = ids;
+	int *dst_ids = tmp;
+	for (int shift = 0; shift < 64; shift += 8) {
+		int count[256] = {0};
+		for (int i = 0; i < n; ++i) ++count[(src_keys[i] >> shift) & 0xff];
+		if (count[(src_keys[0] >> shift) & 0xff] == n) continue;
+		int offset = 0;
+		for (int d = 0; d < 256; ++d) {
+			int c = count[d];
+			count[d] = offset;
+			offset += c;
 		}
+		for (int i = 0; i < n; ++i) {
+			int dst = count[(src_keys[i] >> shift) & 0xff]++;
+			dst_keys[dst] = src_keys[i];
+			dst_ids[dst] = src_ids[i];
+		}
+		uint64_t *swap_keys = src_keys;
+		src_keys = dst_keys;
+		dst_keys = swap_keys;
+		int *swap_ids = src_ids;
+		src_ids = dst_ids;
+		dst_ids = swap_ids;
 	}
+	if (src_ids != ids) memcpy(ids, src_ids, n * sizeof(int));
+	internal_pack_free(keys);
+	internal_pack_free(tmp);
 }
 
-static void krass_pack_compute(krass_canvas_t *canvas) {
-	assert(canvas->init);
-	int *ids = (int *)kr_malloc(canvas->top * sizeof(int));
-	assert(ids != NULL);
-	internal_sort_by_height(canvas, ids);
-	float w = 1.0f;
-	float h = 1.0f;
-	float area = 0.0f;
-	for (int i = 0; i < canvas->top; ++i) {
-		area += canvas->rects[i].w * canvas->rects[i].h;
+typedef struct pack_bounds {
+	// Minimum canvas size, the total area and the longest side of any rect
+	float w, h, area, side;
+} pack_bounds_t;
+
+typedef struct pack_trial {
+	krass_canvas_t *canvas;
+	krass_pack_heuristic_t heuristic;
+	krass_pack_sort_t sort;
+	int *ids;
+	int count;
+	pack_place_t *mem;
+	pack_place_t *pos;
+	pack_place_t *scratch;
+	float w, h;
+	// Whether `pos` was laid out with rotations enabled
+	bool rotate;
+	bool found;
+} pack_trial_t;
+
+// Bounds of the rects in `ids`, or of all rects if `ids` is NULL
+static void internal_bounds(krass_canvas_t *canvas, const int *ids, int count, pack_bounds_t *b) {
+	// Every rect occupies one extra pixel to the right and bottom, see the packers
+	b->w = 1.0f;
+	b->h = 1.0f;
+	b->area = 0.0f;
+	b->side = 1.0f;
+	for (int i = 0; i < count; ++i) {
+		krass_rect_t *r = &canvas->rects[ids != NULL ? ids[i] : i];
+		float w = ceilf(r->w) + 1;
+		float h = ceilf(r->h) + 1;
+		b->area += w * h;
+		if (w > b->side) b->side = w;
+		if (h > b->side) b->side = h;
+		// A rotatable rect only demands its shorter side in either direction
+		if (r->rotatable && w != h) {
+			w = w < h ? w : h;
+			h = w;
+		}
+		if (w > b->w) b->w = w;
+		if (h > b->h) b->h = h;
 	}
-	while (w * h < area) {
-		if (h > w)
-			w *= 2.0f;
+}
+
+static int internal_log2_ceil(float v) {
+	int e = 0;
+	while (e < 30 && (float)(1 << e) < v) ++e;
+	return e;
+}
+
+static int internal_log2_floor(float v) {
+	int e = 0;
+	while (e < 30 && (float)(1 << (e + 1)) <= v) ++e;
+	return e;
+}
+
+// Largest side a page may have, rounded down to a power of two unless the canvas allows npot
+static float internal_max_side(const krass_canvas_t *canvas) {
+	if (canvas->npot) return canvas->max_size;
+	return (float)(1 << internal_log2_floor(canvas->max_size));
+}
+
+static bool internal_trial_layout(pack_trial_t *t, float w, float h, bool rotate) {
+	krass_canvas_t *canvas = t->canvas;
+#ifndef NDEBUG
+	kinc_log(KINC_LOG_LEVEL_INFO, "Trying %dx%d to pack.", (int)w, (int)h);
+#endif
+	krass_packer_t p;
+	internal_packer_init(&p, t->heuristic, w, h, t->count);
+	p.rotate = rotate;
+	bool success = true;
+	for (int i = 0; i < t->count; ++i) {
+		if (!internal_packer_place(&p, &t->scratch[i], &canvas->rects[t->ids[i]])) {
+			success = false;
+			break;
+		}
+	}
+	internal_packer_destroy(&p);
+	if (success) {
+		pack_place_t *tmp = t->pos;
+		t->pos = t->scratch;
+		t->scratch = tmp;
+		t->w = w;
+		t->h = h;
+		t->rotate = rotate;
+	}
+	return success;
+}
+
+// Greedily turning rects can also backfire, so a failed layout is retried upright. Rotation then
+// never needs a larger canvas than packing without it.
+static bool internal_trial_attempt(pack_trial_t *t, float w, float h) {
+	if (internal_trial_layout(t, w, h, true)) return true;
+	return t->canvas->rotatable && internal_trial_layout(t, w, h, false);
+}
+
+static bool internal_search_pot(pack_trial_t *t, const pack_bounds_t *b, int max_exp) {
+	int ew_min = internal_log2_ceil(b->w);
+	int eh_min = internal_log2_ceil(b->h);
+	int level = internal_log2_ceil(b->area);
+	if (ew_min + eh_min > level) level = ew_min + eh_min;
+	// Candidates of the same area are tried from square to skewed, taller before wider. Skewed
+	// canvases are only considered when a single rect demands it.
+	int max_skew = ew_min > eh_min ? ew_min - eh_min : eh_min - ew_min;
+	if (max_skew < KRASS_MAX_SKEW) max_skew = KRASS_MAX_SKEW;
+	for (; level <= 2 * max_exp; ++level) {
+		for (int skew = level & 1; skew <= level && skew <= max_skew; skew += 2) {
+			int tall = (level + skew) / 2;
+			int wide = level - tall;
+			if (tall > max_exp) continue;
+			if (wide >= ew_min && tall >= eh_min &&
+			    internal_trial_attempt(t, (float)(1 << wide), (float)(1 << tall)))
+				return true;
+			if (skew > 0 && tall >= ew_min && wide >= eh_min &&
+			    internal_trial_attempt(t, (float)(1 << tall), (float)(1 << wide)))
+				return true;
+		}
+	}
+	return false;
+}
+
+// Binary search for the smallest other side when one side is fixed, only accepting layouts that
+// are smaller than the current best
+static void internal_search_side(pack_trial_t *t, const pack_bounds_t *b, float fixed,
+                                 bool fixed_is_width, float max_size) {
+	float lo = ceilf(b->area / fixed);
+	float other_min = fixed_is_width ? b->h : b->w;
+	if (other_min > lo) lo = other_min;
+	float hi = floorf((t->w * t->h - 1.0f) / fixed);
+	if (max_size < hi) hi = max_size;
+	if (lo > hi) return;
+	float w = fixed_is_width ? fixed : hi;
+	float h = fixed_is_width ? hi : fixed;
+	if (!internal_trial_attempt(t, w, h)) return;
+	while (lo < hi) {
+		float mid = floorf((lo + hi) * 0.5f);
+		w = fixed_is_width ? fixed : mid;
+		h = fixed_is_width ? mid : fixed;
+		if (internal_trial_attempt(t, w, h))
+			hi = mid;
 		else
-			h *= 2.0f;
+			lo = mid + 1.0f;
 	}
+}
 
-	kr_vec2_t *pos = (kr_vec2_t *)kr_malloc(canvas->top * sizeof(kr_vec2_t));
-	assert(pos != NULL);
+static bool internal_search_npot(pack_trial_t *t, const pack_bounds_t *b, float max_size) {
+	float lo = ceilf(sqrtf(b->area));
+	if (b->w > lo) lo = b->w;
+	if (b->h > lo) lo = b->h;
+	if (lo > max_size || !internal_trial_attempt(t, max_size, max_size)) return false;
+	float hi = max_size;
+	while (lo < hi) {
+		float mid = floorf((lo + hi) * 0.5f);
+		if (internal_trial_attempt(t, mid, mid))
+			hi = mid;
+		else
+			lo = mid + 1.0f;
+	}
+	// Probe narrower and flatter canvases down to an aspect ratio of about 1:4
+	float side = hi;
+	float min_w = b->w > side * 0.5f ? b->w : ceilf(side * 0.5f);
+	float min_h = b->h > side * 0.5f ? b->h : ceilf(side * 0.5f);
+	for (int k = 1; k <= KRASS_NPOT_SAMPLES; ++k) {
+		float w = floorf(side - (side - min_w) * k / KRASS_NPOT_SAMPLES);
+		internal_search_side(t, b, w, true, max_size);
+		float h = floorf(side - (side - min_h) * k / KRASS_NPOT_SAMPLES);
+		internal_search_side(t, b, h, false, max_size);
+	}
+	return true;
+}
+
+static void internal_trial_init(pack_trial_t *t, krass_canvas_t *canvas,
+                                krass_pack_heuristic_t heuristic, krass_pack_sort_t sort,
+                                int count) {
+	int n = count > 0 ? count : 1;
+	t->canvas = canvas;
+	t->count = count;
+	t->heuristic = heuristic;
+	t->sort = sort;
+	t->ids = (int *)kr_malloc(n * sizeof(int));
+	assert(t->ids != NULL);
+	t->mem = (pack_place_t *)kr_malloc(2 * n * sizeof(pack_place_t));
+	assert(t->mem != NULL);
+	t->pos = t->mem;
+	t->scratch = t->mem + n;
+	t->w = 0.0f;
+	t->h = 0.0f;
+	t->rotate = true;
+	t->found = false;
+}
+
+static void internal_trial_destroy(pack_trial_t *t) {
+	kr_free(t->ids);
+	kr_free(t->mem);
+}
+
+static void internal_trial_run(pack_trial_t *t, const pack_bounds_t *b) {
+	krass_canvas_t *canvas = t->canvas;
+	internal_sort(canvas, t->sort, t->ids);
+	t->found = canvas->npot ? internal_search_npot(t, b, canvas->max_size)
+	                        : internal_search_pot(t, b, internal_log2_floor(canvas->max_size));
+}
+
+static bool internal_trial_better(const pack_trial_t *a, const pack_trial_t *b) {
+	if (!b->found) return a->found;
+	if (!a->found) return false;
+	float area_a = a->w * a->h;
+	float area_b = b->w * b->h;
+	if (area_a != area_b) return area_a < area_b;
+	// Prefer the squarer canvas on equal area
+	float side_a = a->w > a->h ? a->w : a->h;
+	float side_b = b->w > b->h ? b->w : b->h;
+	return side_a < side_b;
+}
+
+typedef struct pack_pool {
+	pack_trial_t *trials;
+	const pack_bounds_t *bounds;
+	int count, next;
+	kinc_mutex_t mutex;
+} pack_pool_t;
+
+static void internal_pool_work(void *param) {
+	pack_pool_t *pool = (pack_pool_t *)param;
 	while (true) {
+		kinc_mutex_lock(&pool->mutex);
+		int i = pool->next++;
+		kinc_mutex_unlock(&pool->mutex);
+		if (i >= pool->count) break;
+		internal_trial_run(&pool->trials[i], pool->bounds);
+	}
+}
+
+static void internal_pool_run(pack_pool_t *pool, int threads) {
+	if (threads > pool->count) threads = pool->count;
+	if (threads <= 1) {
+		for (int i = 0; i < pool->count; ++i) internal_trial_run(&pool->trials[i], pool->bounds);
+		return;
+	}
+	kinc_mutex_init(&pool->mutex);
+	kinc_mutex_t alloc_mutex;
+	kinc_mutex_init(&alloc_mutex);
+	kinc_thread_t *workers = (kinc_thread_t *)kr_malloc((threads - 1) * sizeof(kinc_thread_t));
+	assert(workers != NULL);
+	pack_alloc_mutex = &alloc_mutex;
+	for (int i = 0; i < threads - 1; ++i) kinc_thread_init(&workers[i], internal_pool_work, pool);
+	internal_pool_work(pool);
+	for (int i = 0; i < threads - 1; ++i) kinc_thread_wait_and_destroy(&workers[i]);
+	pack_alloc_mutex = NULL;
+	kr_free(workers);
+	kinc_mutex_destroy(&alloc_mutex);
+	kinc_mutex_destroy(&pool->mutex);
+}
+
+static int internal_count_bits(unsigned mask) {
+	int count = 0;
+	for (; mask != 0; mask &= mask - 1) ++count;
+	return count;
+}
+
+static uint32_t internal_rand(uint32_t *state) {
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+// Picks the next smaller canvas the optimizer should try to reach, false if the bounds forbid it
+static bool internal_next_target(krass_canvas_t *canvas, const pack_bounds_t *b, float w, float h,
+                                 float *tw, float *th) {
+	if (canvas->npot) {
+		float step_w = floorf(w / 128.0f) > 1.0f ? floorf(w / 128.0f) : 1.0f;
+		float step_h = floorf(h / 128.0f) > 1.0f ? floorf(h / 128.0f) : 1.0f;
+		bool shrink_w = w - step_w >= b->w && (w - step_w) * h >= b->area;
+		bool shrink_h = h - step_h >= b->h && w * (h - step_h) >= b->area;
+		if (shrink_w && (w >= h || !shrink_h)) {
+			*tw = w - step_w;
+			*th = h;
+			return true;
+		}
+		if (shrink_h) {
+			*tw = w;
+			*th = h - step_h;
+			return true;
+		}
+		return false;
+	}
+	int level = internal_log2_floor(w) + internal_log2_floor(h) - 1;
+	int ew_min = internal_log2_ceil(b->w);
+	int eh_min = internal_log2_ceil(b->h);
+	if (level < internal_log2_ceil(b->area)) return false;
+	for (int skew = level & 1; skew <= level && skew <= KRASS_MAX_SKEW; skew += 2) {
+		int tall = (level + skew) / 2;
+		int wide = level - tall;
+		if (wide >= ew_min && tall >= eh_min) {
+			*tw = (float)(1 << wide);
+			*th = (float)(1 << tall);
+			return true;
+		}
+		if (tall >= ew_min && wide >= eh_min) {
+			*tw = (float)(1 << tall);
+			*th = (float)(1 << wide);
+			return true;
+		}
+	}
+	return false;
+}
+
+// Packs `order` into w*h, skipping rects that do not fit. Returns false if the deadline passed
+// before finishing, otherwise `unplaced` holds the padded area that did not fit.
+static bool internal_evaluate(pack_trial_t *t, const int *order, float w, float h, double deadline,
+                              float *unplaced) {
+	krass_canvas_t *canvas = t->canvas;
+	krass_packer_t p;
+	internal_packer_init(&p, t->heuristic, w, h, t->count);
+	p.rotate = t->rotate;
+	*unplaced = 0.0f;
+	bool finished = true;
+	for (int i = 0; i < t->count; ++i) {
+		krass_rect_t *r = &canvas->rects[order[i]];
+		if (!internal_packer_place(&p, &t->scratch[i], r))
+			*unplaced += (ceilf(r->w) + 1) * (ceilf(r->h) + 1);
+		if ((i & 31) == 31 && kinc_time() > deadline) {
+			finished = false;
+			break;
+		}
+	}
+	internal_packer_destroy(&p);
+	return finished;
+}
+
+// Simulated annealing over the insertion order of the best trial. Every time an order fits the
+// next smaller canvas it becomes the new layout and the target shrinks again.
+static void internal_optimize(pack_trial_t *t, const pack_bounds_t *b, double deadline) {
+	krass_canvas_t *canvas = t->canvas;
+	int n = t->count;
+	float tw, th, current, cost;
+	if (n < 2 || !internal_next_target(canvas, b, t->w, t->h, &tw, &th)) return;
+	int *order = (int *)kr_malloc(2 * n * sizeof(int));
+	assert(order != NULL);
+	int *candidate = order + n;
+	memcpy(order, t->ids, n * sizeof(int));
+	if (!internal_evaluate(t, order, tw, th, deadline, &current)) {
+		kr_free(order);
+		return;
+	}
+	uint32_t rng = 0x9e3779b9u;
+	double start = kinc_time();
+	float t0 = b->area / (float)n;
+	int improvements = 0;
+	while (kinc_time() < deadline) {
+		memcpy(candidate, order, n * sizeof(int));
+		int i = (int)(internal_rand(&rng) % (uint32_t)n);
+		int j = (int)(internal_rand(&rng) % (uint32_t)n);
+		if (internal_rand(&rng) & 1) {
+			int tmp = candidate[i];
+			candidate[i] = candidate[j];
+			candidate[j] = tmp;
+		}
+		else if (i != j) {
+			// Move one rect to another slot, shifting the ones in between
+			int moved = candidate[i];
+			if (i < j)
+				memmove(&candidate[i], &candidate[i + 1], (j - i) * sizeof(int));
+			else
+				memmove(&candidate[j + 1], &candidate[j], (i - j) * sizeof(int));
+			candidate[j] = moved;
+		}
+		if (!internal_evaluate(t, candidate, tw, th, deadline, &cost)) break;
+		if (cost == 0.0f) {
+			memcpy(t->ids, candidate, n * sizeof(int));
+			memcpy(order, candidate, n * sizeof(int));
+			pack_place_t *tmp = t->pos;
+			t->pos = t->scratch;
+			t->scratch = tmp;
+			t->w = tw;
+			t->h = th;
+			++improvements;
+			if (!internal_next_target(canvas, b, t->w, t->h, &tw, &th)) break;
+			if (!internal_evaluate(t, order, tw, th, deadline, &current)) break;
+			continue;
+		}
+		float progress = (float)((kinc_time() - start) / (deadline - start));
+		float temperature = t0 * (1.0f - progress) + 1e-3f;
+		float r = (float)(internal_rand(&rng) & 0xffffff) / (float)0x1000000;
+		if (cost <= current || r < expf((current - cost) / temperature)) {
+			memcpy(order, candidate, n * sizeof(int));
+			current = cost;
+		}
+	}
+#ifndef NDEBUG
+	kinc_log(KINC_LOG_LEVEL_INFO, "Optimizer shrank the canvas %d times to %dx%d.", improvements,
+	         (int)t->w, (int)t->h);
+#endif
+	kr_free(order);
+}
+
+static void internal_add_page(krass_canvas_t *canvas, pack_trial_t *t) {
+	int page = canvas->page_count++;
+	canvas->pages =
+	    (krass_page_t *)kr_realloc(canvas->pages, canvas->page_count * sizeof(krass_page_t));
+	assert(canvas->pages != NULL);
+	canvas->pages[page].w = t->w;
+	canvas->pages[page].h = t->h;
+	for (int i = 0; i < t->count; ++i) {
+		canvas->rects[t->ids[i]].x = t->pos[i].pos.x;
+		canvas->rects[t->ids[i]].y = t->pos[i].pos.y;
+		canvas->rects[t->ids[i]].page = page;
+		canvas->rects[t->ids[i]].rotated = t->pos[i].rotated;
+	}
+
+	// Replay the layout to keep its free space around for krass_pack_insert
+	krass_packer_t *packer = (krass_packer_t *)kr_malloc(sizeof(krass_packer_t));
+	assert(packer != NULL);
+	internal_packer_init(packer, t->heuristic, t->w, t->h, t->count);
+	packer->rotate = t->rotate;
+	for (int i = 0; i < t->count; ++i) {
+		pack_place_t place;
+		bool placed = internal_packer_place(packer, &place, &canvas->rects[t->ids[i]]);
+		assert(placed && place.pos.x == t->pos[i].pos.x && place.pos.y == t->pos[i].pos.y &&
+		       place.rotated == t->pos[i].rotated);
+		(void)placed;
+	}
+	packer->rotate = true;
+	canvas->pages[page].packer = packer;
 #ifndef NDEBUG
-		kinc_log(KINC_LOG_LEVEL_INFO, "Area to pack %d, using %dx%d to pack.", (int)area, (int)w,
-		         (int)h);
-		for (int i = 0; i < canvas->top; ++i) {
-			kinc_log(KINC_LOG_LEVEL_INFO, "%d - %fx%f", ids[i], canvas->rects[ids[i]].w,
-			         canvas->rects[ids[i]].h);
+	kinc_log(KINC_LOG_LEVEL_INFO, "Page %d packed into %dx%d using heuristic %d and sort %d.",
+	         page, (int)t->w, (int)t->h, (int)t->heuristic, (int)t->sort);
+#endif
+}
+
+// Distributes the sorted rects of `t` first fit over pages of the maximum size, opening a new page
+// only when no existing one has room. Every page is then shrunk to the smallest canvas on its own.
+static void internal_spill_pages(krass_canvas_t *canvas, pack_trial_t *t) {
+	int n = t->count;
+	int *page_of = (int *)kr_malloc(n * sizeof(int));
+	assert(page_of != NULL);
+	krass_packer_t *packers = NULL;
+	int page_count = 0;
+	float side = internal_max_side(canvas);
+	for (int i = 0; i < n; ++i) {
+		krass_rect_t *r = &canvas->rects[t->ids[i]];
+		pack_place_t place;
+		int page = 0;
+		while (page < page_count && !internal_packer_place(&packers[page], &place, r)) ++page;
+		if (page == page_count) {
+			packers = (krass_packer_t *)kr_realloc(packers, ++page_count * sizeof(krass_packer_t));
+			assert(packers != NULL);
+			internal_packer_init(&packers[page], t->heuristic, side, side, n);
+			bool placed = internal_packer_place(&packers[page], &place, r);
+			assert(placed);
+			(void)placed;
 		}
+		page_of[i] = page;
+	}
+	for (int page = 0; page < page_count; ++page) internal_packer_destroy(&packers[page]);
+	kr_free(packers);
+
+	for (int page = 0; page < page_count; ++page) {
+		int count = 0;
+		for (int i = 0; i < n; ++i) count += page_of[i] == page ? 1 : 0;
+		pack_trial_t pt;
+		internal_trial_init(&pt, canvas, t->heuristic, t->sort, count);
+		count = 0;
+		for (int i = 0; i < n; ++i)
+			if (page_of[i] == page) pt.ids[count++] = t->ids[i];
+		pack_bounds_t b;
+		internal_bounds(canvas, pt.ids, pt.count, &b);
+		// The same order already fit the full size page, so the search always succeeds
+		if (canvas->npot)
+			pt.found = internal_search_npot(&pt, &b, canvas->max_size);
+		else
+			pt.found = internal_search_pot(&pt, &b, internal_log2_floor(canvas->max_size));
+		assert(pt.found);
+		internal_add_page(canvas, &pt);
+		internal_trial_destroy(&pt);
+	}
+	kr_free(page_of);
+}
+
+// Packs greedily, then spends whatever is left of `budget` seconds on shrinking the layout. Rects
+// that do not fit into one canvas of the maximum size spill into additional pages.
+static void krass_pack_compute(krass_canvas_t *canvas, double budget) {
+	assert(canvas->init);
+	double deadline = kinc_time() + budget;
+	pack_bounds_t b;
+	internal_bounds(canvas, NULL, canvas->top, &b);
+#ifndef NDEBUG
+	kinc_log(KINC_LOG_LEVEL_INFO, "Area to pack %d, at least %dx%d.", (int)b.area, (int)b.w,
+	         (int)b.h);
+	for (int i = 0; i < canvas->top; ++i) {
+		kinc_log(KINC_LOG_LEVEL_INFO, "%d - %fx%f", i, canvas->rects[i].w, canvas->rects[i].h);
+	}
 #endif
-		free_area_t a;
-		internal_fa_init(&a, w, h, canvas->top); // Reserve too much...
-		bool success = true;
-		for (int i = 0; i < canvas->top; ++i) {
-			if (!internal_fa_place(&a, &pos[i], canvas->rects[ids[i]].w, canvas->rects[ids[i]].h)) {
-				if (h > w)
-					w *= 2.0f;
-				else
-					h *= 2.0f;
-				success = false;
-				break;
-			}
+
+	unsigned heuristics = canvas->trial_heuristics;
+	unsigned sorts = canvas->trial_sorts;
+	if (heuristics == 0) heuristics = KRASS_PACK_TRIAL(canvas->heuristic);
+	if (sorts == 0) sorts = KRASS_PACK_TRIAL(canvas->sort);
+	pack_pool_t pool;
+	pool.count = internal_count_bits(heuristics) * internal_count_bits(sorts);
+	pool.next = 0;
+	pool.bounds = &b;
+	pool.trials = (pack_trial_t *)kr_malloc(pool.count * sizeof(pack_trial_t));
+	assert(pool.trials != NULL);
+	int count = 0;
+	for (int h = 0; h < 32; ++h) {
+		if ((heuristics & KRASS_PACK_TRIAL(h)) == 0) continue;
+		for (int s = 0; s < 32; ++s) {
+			if ((sorts & KRASS_PACK_TRIAL(s)) == 0) continue;
+			internal_trial_init(&pool.trials[count++], canvas, (krass_pack_heuristic_t)h,
+			                    (krass_pack_sort_t)s, canvas->top);
 		}
-		internal_fa_destroy(&a);
-		if (success) {
-			canvas->w = w;
-			canvas->h = h;
-			for (int i = 0; i < canvas->top; ++i) {
-				canvas->rects[ids[i]].x = pos[i].x;
-				canvas->rects[ids[i]].y = pos[i].y;
+	}
+	internal_pool_run(&pool, canvas->threads);
+
+	// Trials are compared in a fixed order, the layout does not depend on thread scheduling
+	pack_trial_t *best = &pool.trials[0];
+	for (int i = 1; i < pool.count; ++i) {
+		if (internal_trial_better(&pool.trials[i], best)) best = &pool.trials[i];
+	}
+	internal_release_pages(canvas);
+	if (best->found) {
+		if (budget > 0.0) internal_optimize(best, &b, deadline);
+		internal_add_page(canvas, best);
+	}
+	else if (b.side > internal_max_side(canvas)) {
+		int side = (int)internal_max_side(canvas);
+		kinc_log(KINC_LOG_LEVEL_ERROR, "An asset is larger than %dx%d, exceeding the maximum size",
+		         side, side);
+		if (internal_search_pot(best, &b, 30)) {
+			internal_add_page(canvas, best);
+		}
+		else {
+			// Not even the largest canvas holds it, clamp the rects so that they spill instead.
+			// One pixel of every side goes to the spacing between rects
+			float limit = (float)(side - 1);
+			kinc_log(KINC_LOG_LEVEL_ERROR, "No canvas fits the assets, clamping them to %dx%d",
+			         side - 1, side - 1);
+			for (int i = 0; i < best->count; ++i) {
+				krass_rect_t *r = &canvas->rects[best->ids[i]];
+				if (r->w > limit) r->w = limit;
+				if (r->h > limit) r->h = limit;
 			}
-			break;
+			internal_spill_pages(canvas, best);
 		}
 	}
-	kr_free(ids);
-	kr_free(pos);
+	else {
+		internal_spill_pages(canvas, best);
+	}
+	for (int i = 0; i < pool.count; ++i) internal_trial_destroy(&pool.trials[i]);
+	kr_free(pool.trials);
+}
+
+// Places a rect added after krass_pack_compute into the remaining free space of the first page
+// that has room for it
+static bool krass_pack_insert(krass_canvas_t *canvas, int id) {
+	assert(canvas->init);
+	assert(canvas->top > id && id >= 0);
+	krass_rect_t *r = &canvas->rects[id];
+	for (int page = 0; page < canvas->page_count; ++page) {
+		pack_place_t place;
+		if (canvas->pages[page].packer == NULL) continue;
+		if (!internal_packer_place(canvas->pages[page].packer, &place, r)) continue;
+		r->x = place.pos.x;
+		r->y = place.pos.y;
+		r->page = page;
+		r->rotated = place.rotated;
+		return true;
+	}
+	return false;
+}
+
+// Adopts a previously computed layout of `page_count` pages with sizes as w, h pairs. The pages
+// keep no free space, so rects added afterwards need a new krass_pack_compute.
+static void krass_pack_restore(krass_canvas_t *canvas, const krass_rect_t *rects,
+                               const float *sizes, int page_count) {
+	assert(canvas->init);
+	internal_release_pages(canvas);
+	if (canvas->top > 0) memcpy(canvas->rects, rects, canvas->top * sizeof(krass_rect_t));
+	canvas->pages = (krass_page_t *)kr_malloc(page_count * sizeof(krass_page_t));
+	assert(canvas->pages != NULL);
+	canvas->page_count = page_count;
+	for (int i = 0; i < page_count; ++i) {
+		canvas->pages[i].w = sizes[2 * i];
+		canvas->pages[i].h = sizes[2 * i + 1];
+		canvas->pages[i].packer = NULL;
+	}
 }
 
 static krass_rect_t krass_pack_get_rect(krass_canvas_t *canvas, int id) {
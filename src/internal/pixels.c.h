@@ -0,0 +1,396 @@
+#pragma once
+
+#include <math.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(KRASS_NO_SIMD)
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define KRASS_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define KRASS_NEON
+#include <arm_neon.h>
+#endif
+
+// Rows processed together, small enough that both bands are still cached when gathering stats
+#define KRASS_PIXEL_GROUP 16
+// Squared distance of samples without a seed when building distance fields
+#define KRASS_PIXEL_FAR 1e20f
+
+// Rows [y0, y1) and columns [x0, x1) of a page
+typedef struct krass_pixel_rect {
+	int x0, y0, x1, y1;
+} krass_pixel_rect_t;
+
+typedef struct krass_pixel_ops {
+	bool premultiply;
+	bool swap_red_blue;
+	// Rects that were converted before, e.g. copied from a previous texture, sorted by `x0`.
+	// Rects sharing a row must not overlap
+	const krass_pixel_rect_t *skip;
+	int skip_count;
+} krass_pixel_ops_t;
+
+// Area of one asset in pixels, its alpha range is widened by every row processed
+typedef struct krass_pixel_span {
+	int x0, y0, x1, y1;
+	uint8_t alpha_min, alpha_max;
+	// Owner of the span, left alone by the processing
+	int id;
+} krass_pixel_span_t;
+
+static void internal_pixels_swap(uint8_t *a, uint8_t *b, int bytes) {
+	int i = 0;
+#if defined(KRASS_SSE2)
+	for (; i + 16 <= bytes; i += 16) {
+		__m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+		__m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+		_mm_storeu_si128((__m128i *)(a + i), vb);
+		_mm_storeu_si128((__m128i *)(b + i), va);
+	}
+#elif defined(KRASS_NEON)
+	for (; i + 16 <= bytes; i += 16) {
+		uint8x16_t va = vld1q_u8(a + i);
+		uint8x16_t vb = vld1q_u8(b + i);
+		vst1q_u8(a + i, vb);
+		vst1q_u8(b + i, va);
+	}
+#endif
+	for (; i < bytes; ++i) {
+		uint8_t tmp = a[i];
+		a[i] = b[i];
+		b[i] = tmp;
+	}
+}
+
+// c * a / 255 rounded, exact for all 8 bit inputs
+static uint8_t internal_pixels_mul(unsigned c, unsigned a) {
+	unsigned t = c * a + 128;
+	return (uint8_t)((t + (t >> 8)) >> 8);
+}
+
+static void internal_pixels_convert_scalar(uint8_t *p, int count, const krass_pixel_ops_t *ops) {
+	for (int i = 0; i < count; ++i, p += 4) {
+		if (ops->swap_red_blue) {
+			uint8_t tmp = p[0];
+			p[0] = p[2];
+			p[2] = tmp;
+		}
+		if (ops->premultiply) {
+			p[0] = internal_pixels_mul(p[0], p[3]);
+			p[1] = internal_pixels_mul(p[1], p[3]);
+			p[2] = internal_pixels_mul(p[2], p[3]);
+		}
+	}
+}
+
+#if defined(KRASS_SSE2)
+static __m128i internal_pixels_premultiply_half(__m128i px) {
+	// Alpha of each pixel in all four lanes, the alpha lane itself is scaled by 255
+	__m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(px, 0xff), 0xff);
+	alpha = _mm_or_si128(_mm_and_si128(alpha, _mm_set_epi16(0, -1, -1, -1, 0, -1, -1, -1)),
+	                     _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0));
+	__m128i t = _mm_add_epi16(_mm_mullo_epi16(px, alpha), _mm_set1_epi16(128));
+	return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+#endif
+
+// Applies `ops` to `count` RGBA pixels in place
+static void internal_pixels_convert(uint8_t *p, int count, const krass_pixel_ops_t *ops) {
+	if (ops == NULL || (!ops->premultiply && !ops->swap_red_blue)) return;
+	int i = 0;
+#if defined(KRASS_SSE2)
+	__m128i zero = _mm_setzero_si128();
+	__m128i green_alpha = _mm_set1_epi32((int)0xff00ff00);
+	__m128i low = _mm_set1_epi32(0xff);
+	for (; i + 4 <= count; i += 4) {
+		__m128i px = _mm_loadu_si128((const __m128i *)(p + i * 4));
+		if (ops->swap_red_blue) {
+			__m128i red = _mm_and_si128(px, low);
+			__m128i blue = _mm_and_si128(_mm_srli_epi32(px, 16), low);
+			px = _mm_or_si128(_mm_and_si128(px, green_alpha),
+			                  _mm_or_si128(_mm_slli_epi32(red, 16), blue));
+		}
+		if (ops->premultiply) {
+			__m128i lo = internal_pixels_premultiply_half(_mm_unpacklo_epi8(px, zero));
+			__m128i hi = internal_pixels_premultiply_half(_mm_unpackhi_epi8(px, zero));
+			px = _mm_packus_epi16(lo, hi);
+		}
+		_mm_storeu_si128((__m128i *)(p + i * 4), px);
+	}
+#elif defined(KRASS_NEON)
+	for (; i + 16 <= count; i += 16) {
+		uint8x16x4_t px = vld4q_u8(p + i * 4);
+		if (ops->swap_red_blue) {
+			uint8x16_t tmp = px.val[0];
+			px.val[0] = px.val[2];
+			px.val[2] = tmp;
+		}
+		if (ops->premultiply) {
+			for (int c = 0; c < 3; ++c) {
+				uint16x8_t lo = vmull_u8(vget_low_u8(px.val[c]), vget_low_u8(px.val[3]));
+				uint16x8_t hi = vmull_u8(vget_high_u8(px.val[c]), vget_high_u8(px.val[3]));
+				px.val[c] = vcombine_u8(vraddhn_u16(lo, vrshrq_n_u16(lo, 8)),
+				                        vraddhn_u16(hi, vrshrq_n_u16(hi, 8)));
+			}
+		}
+		vst4q_u8(p + i * 4, px);
+	}
+#endif
+	internal_pixels_convert_scalar(p + i * 4, count - i, ops);
+}
+
+// Widens [*min, *max] by the alpha of `count` RGBA pixels
+static void internal_pixels_alpha_range(const uint8_t *p, int count, uint8_t *min, uint8_t *max) {
+	uint8_t lo = *min;
+	uint8_t hi = *max;
+	int i = 0;
+#if defined(KRASS_SSE2)
+	if (count >= 4) {
+		// Color bytes are forced to 255 for the minimum and 0 for the maximum
+		__m128i color = _mm_set1_epi32(0x00ffffff);
+		__m128i vmin = _mm_set1_epi8((char)0xff);
+		__m128i vmax = _mm_setzero_si128();
+		for (; i + 4 <= count; i += 4) {
+			__m128i px = _mm_loadu_si128((const __m128i *)(p + i * 4));
+			vmin = _mm_min_epu8(vmin, _mm_or_si128(px, color));
+			vmax = _mm_max_epu8(vmax, _mm_andnot_si128(color, px));
+		}
+		uint8_t lanes[16];
+		_mm_storeu_si128((__m128i *)lanes, vmin);
+		for (int k = 3; k < 16; k += 4) lo = lanes[k] < lo ? lanes[k] : lo;
+		_mm_storeu_si128((__m128i *)lanes, vmax);
+		for (int k = 3; k < 16; k += 4) hi = lanes[k] > hi ? lanes[k] : hi;
+	}
+#elif defined(KRASS_NEON)
+	if (count >= 16) {
+		uint8x16_t vmin = vdupq_n_u8(0xff);
+		uint8x16_t vmax = vdupq_n_u8(0);
+		for (; i + 16 <= count; i += 16) {
+			uint8x16x4_t px = vld4q_u8(p + i * 4);
+			vmin = vminq_u8(vmin, px.val[3]);
+			vmax = vmaxq_u8(vmax, px.val[3]);
+		}
+		uint8_t lanes[16];
+		vst1q_u8(lanes, vmin);
+		for (int k = 0; k < 16; ++k) lo = lanes[k] < lo ? lanes[k] : lo;
+		vst1q_u8(lanes, vmax);
+		for (int k = 0; k < 16; ++k) hi = lanes[k] > hi ? lanes[k] : hi;
+	}
+#endif
+	for (; i < count; ++i) {
+		uint8_t a = p[i * 4 + 3];
+		if (a < lo) lo = a;
+		if (a > hi) hi = a;
+	}
+	*min = lo;
+	*max = hi;
+}
+
+// Applies `ops` to the pixels of row `y` of the page that are outside the rects it skips
+static void internal_pixels_convert_row(uint8_t *p, int width, int y,
+                                        const krass_pixel_ops_t *ops) {
+	if (ops == NULL) return;
+	int x = 0;
+	for (int i = 0; i < ops->skip_count; ++i) {
+		const krass_pixel_rect_t *r = &ops->skip[i];
+		if (y < r->y0 || y >= r->y1) continue;
+		if (r->x0 > x) internal_pixels_convert(p + x * 4, r->x0 - x, ops);
+		if (r->x1 > x) x = r->x1;
+	}
+	if (x < width) internal_pixels_convert(p + x * 4, width - x, ops);
+}
+
+// Rows [y0, y1) of `data` are rows [y0 + row, y1 + row) of the page the spans refer to
+static void internal_pixels_gather(const uint8_t *data, int pitch, int row, int y0, int y1,
+                                   krass_pixel_span_t *spans, int span_count) {
+	for (int i = 0; i < span_count; ++i) {
+		krass_pixel_span_t *s = &spans[i];
+		int first = y0 + row > s->y0 ? y0 + row : s->y0;
+		int last = y1 + row < s->y1 ? y1 + row : s->y1;
+		for (int y = first; y < last; ++y) {
+			internal_pixels_alpha_range(data + (y - row) * pitch + s->x0 * 4, s->x1 - s->x0,
+			                            &s->alpha_min, &s->alpha_max);
+		}
+	}
+}
+
+// One pass over up to `count` row pairs from the top and bottom inwards, starting after the first
+// `first` pairs: optionally flips them, applies `ops` and widens the alpha range of the spans
+// touching them. `data` may be a band of a page starting at `row`. Returns the number of pairs
+// done, (height + 1) / 2 once the band is finished.
+static int krass_pixels_process(uint8_t *data, int width, int height, int row, int first,
+                                int count, bool flip, const krass_pixel_ops_t *ops,
+                                krass_pixel_span_t *spans, int span_count) {
+	int pitch = width * 4;
+	int pairs = (height + 1) / 2;
+	int last = first + count < pairs ? first + count : pairs;
+	for (int y = first; y < last; y += KRASS_PIXEL_GROUP) {
+		int end = y + KRASS_PIXEL_GROUP < last ? y + KRASS_PIXEL_GROUP : last;
+		for (int k = y; k < end; ++k) {
+			uint8_t *top = data + k * pitch;
+			uint8_t *bottom = data + (height - 1 - k) * pitch;
+			if (top != bottom) {
+				if (flip) internal_pixels_swap(top, bottom, pitch);
+				internal_pixels_convert_row(bottom, width, row + height - 1 - k, ops);
+			}
+			internal_pixels_convert_row(top, width, row + k, ops);
+		}
+		// The ranges may share the middle row, taking min and max twice is harmless
+		internal_pixels_gather(data, pitch, row, y, end, spans, span_count);
+		internal_pixels_gather(data, pitch, row, height - end, height - y, spans, span_count);
+	}
+	return last;
+}
+
+// Averages blocks of `factor` x `factor` pixels of a `width * factor` x `height * factor` image,
+// weighting the colors by alpha. The `width` x `height` result is stored at the start of `data`
+static void krass_pixels_downsample(uint8_t *data, int width, int height, int factor) {
+	int pitch = width * factor * 4;
+	uint32_t samples = (uint32_t)(factor * factor);
+	for (int y = 0; y < height; ++y) {
+		for (int x = 0; x < width; ++x) {
+			uint32_t sum[4] = {0, 0, 0, 0};
+			for (int j = 0; j < factor; ++j) {
+				const uint8_t *p = data + (y * factor + j) * pitch + x * factor * 4;
+				for (int i = 0; i < factor; ++i, p += 4) {
+					sum[0] += p[0] * p[3];
+					sum[1] += p[1] * p[3];
+					sum[2] += p[2] * p[3];
+					sum[3] += p[3];
+				}
+			}
+			// Written behind every block still to be read
+			uint8_t *out = data + (y * width + x) * 4;
+			if (sum[3] == 0) {
+				memset(out, 0, 4);
+				continue;
+			}
+			for (int c = 0; c < 3; ++c) out[c] = (uint8_t)((sum[c] + sum[3] / 2) / sum[3]);
+			out[3] = (uint8_t)((sum[3] + samples / 2) / samples);
+		}
+	}
+}
+
+// Scales a `src_width` x `src_height` RGBA image to `width` x `height` with bilinear filtering,
+// sampling pixel centers like drawing it scaled on the GPU does
+static void krass_pixels_resample(const uint8_t *src, int src_width, int src_height, uint8_t *dst,
+                                  int width, int height, int stride) {
+	if (src_width == width && src_height == height) {
+		for (int y = 0; y < height; ++y) memcpy(dst + y * stride, src + y * width * 4, width * 4);
+		return;
+	}
+	float scale_x = (float)src_width / (float)width;
+	float scale_y = (float)src_height / (float)height;
+	for (int y = 0; y < height; ++y) {
+		float fy = ((float)y + 0.5f) * scale_y - 0.5f;
+		if (fy < 0.0f) fy = 0.0f;
+		int y0 = (int)fy < src_height - 1 ? (int)fy : src_height - 1;
+		int y1 = y0 + 1 < src_height ? y0 + 1 : y0;
+		float ty = fy - (float)y0;
+		if (ty > 1.0f) ty = 1.0f;
+		const uint8_t *row0 = src + y0 * src_width * 4;
+		const uint8_t *row1 = src + y1 * src_width * 4;
+		uint8_t *out = dst + y * stride;
+		for (int x = 0; x < width; ++x, out += 4) {
+			float fx = ((float)x + 0.5f) * scale_x - 0.5f;
+			if (fx < 0.0f) fx = 0.0f;
+			int x0 = (int)fx < src_width - 1 ? (int)fx : src_width - 1;
+			int x1 = x0 + 1 < src_width ? x0 + 1 : x0;
+			float tx = fx - (float)x0;
+			if (tx > 1.0f) tx = 1.0f;
+			for (int c = 0; c < 4; ++c) {
+				float top = row0[x0 * 4 + c] + (row0[x1 * 4 + c] - row0[x0 * 4 + c]) * tx;
+				float bottom = row1[x0 * 4 + c] + (row1[x1 * 4 + c] - row1[x0 * 4 + c]) * tx;
+				out[c] = (uint8_t)(top + (bottom - top) * ty + 0.5f);
+			}
+		}
+	}
+}
+
+// Squared distance from every one of `n` samples to the nearest seed, where `f` is 0 and
+// KRASS_PIXEL_FAR elsewhere. Lower envelope of parabolas after Felzenszwalb and Huttenlocher
+static void internal_pixels_edt(const float *f, float *d, float *v, float *z, int n) {
+	int k = 0;
+	v[0] = 0.0f;
+	z[0] = -KRASS_PIXEL_FAR;
+	z[1] = KRASS_PIXEL_FAR;
+	for (int q = 1; q < n; ++q) {
+		float s;
+		while (true) {
+			int p = (int)v[k];
+			s = ((f[q] + (float)(q * q)) - (f[p] + (float)(p * p))) / (float)(2 * q - 2 * p);
+			if (s > z[k]) break;
+			--k;
+		}
+		++k;
+		v[k] = (float)q;
+		z[k] = s;
+		z[k + 1] = KRASS_PIXEL_FAR;
+	}
+	k = 0;
+	for (int q = 0; q < n; ++q) {
+		while (z[k + 1] < (float)q) ++k;
+		int p = (int)v[k];
+		d[q] = (float)((q - p) * (q - p)) + f[p];
+	}
+}
+
+// Columns first, then rows of the `width` x `height` grid
+static void internal_pixels_edt_2d(float *grid, int width, int height, float *line) {
+	int n = width > height ? width : height;
+	float *d = line + n;
+	float *v = d + n;
+	float *z = v + n;
+	for (int x = 0; x < width; ++x) {
+		for (int y = 0; y < height; ++y) line[y] = grid[y * width + x];
+		internal_pixels_edt(line, d, v, z, height);
+		for (int y = 0; y < height; ++y) grid[y * width + x] = d[y];
+	}
+	for (int y = 0; y < height; ++y) {
+		internal_pixels_edt(grid + y * width, d, v, z, width);
+		memcpy(grid + y * width, d, width * sizeof(float));
+	}
+}
+
+// Floats of scratch memory krass_pixels_sdf needs for a `width` x `height` rect
+static size_t krass_pixels_sdf_scratch(int width, int height) {
+	size_t n = (size_t)(width > height ? width : height);
+	return (size_t)width * height * 2 + n * 4 + 1;
+}
+
+// Replaces the alpha coverage of a rect of an image with a signed distance field, 0.5 on the
+// outline and reaching 1 `spread` pixels inside and 0 as far outside. Colors become white, scaled
+// by the field when `premultiply` is set
+static void krass_pixels_sdf(uint8_t *data, int pitch, int x, int y, int width, int height,
+                             int spread, bool premultiply, float *scratch) {
+	size_t count = (size_t)width * height;
+	// Squared distances to the nearest pixel inside and outside the outline
+	float *inside = scratch;
+	float *outside = inside + count;
+	for (int j = 0; j < height; ++j) {
+		const uint8_t *p = data + (size_t)(y + j) * pitch + x * 4;
+		for (int i = 0; i < width; ++i, p += 4) {
+			bool in = p[3] >= 128;
+			inside[j * width + i] = in ? 0.0f : KRASS_PIXEL_FAR;
+			outside[j * width + i] = in ? KRASS_PIXEL_FAR : 0.0f;
+		}
+	}
+	internal_pixels_edt_2d(inside, width, height, outside + count);
+	internal_pixels_edt_2d(outside, width, height, outside + count);
+	float scale = 127.5f / (float)spread;
+	for (int j = 0; j < height; ++j) {
+		uint8_t *p = data + (size_t)(y + j) * pitch + x * 4;
+		for (int i = 0; i < width; ++i, p += 4) {
+			size_t k = (size_t)j * width + i;
+			// Pixel centers sit half a pixel off the outline between them
+			float sd = p[3] >= 128 ? sqrtf(outside[k]) - 0.5f : 0.5f - sqrtf(inside[k]);
+			float a = 127.5f + sd * scale;
+			p[3] = (uint8_t)(a < 0.0f ? 0.0f : a > 255.0f ? 255.0f : a + 0.5f);
+			p[0] = p[1] = p[2] = premultiply ? p[3] : 255;
+		}
+	}
+}
@@ -1,6 +1,9 @@
 #include "krass.h"
 
+#include "internal/cache.c.h"
+#include "internal/glyphs.c.h"
 #include "internal/pack.c.h"
+#include "internal/pixels.c.h"
 
 #ifndef NDEBUG
 #define STB_IMAGE_WRITE_IMPLEMENTATION
@@ -9,12 +12,22 @@
 
 #include <kinc/graphics4/graphics.h>
 #include <kinc/graphics4/rendertarget.h>
+#include <kinc/image.h>
+#include <kinc/system.h>
+#include <kinc/threads/mutex.h>
+#include <kinc/threads/thread.h>
 #include <krink/graphics2/graphics.h>
 #include <krink/memory.h>
 
 #include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#define KRASS_QUARTER_TURN 1.57079632679f
+// Bytes of pixel rows processed per tick after a readback
+#define KRASS_PROCESS_BYTES (4 << 20)
+
 typedef enum krass_type {
 	KRASS_TYPE_IMAGE,
 	KRASS_TYPE_FONT,
@@ -24,15 +37,64 @@ typedef struct krass_image {
 	int pack_id;
 	krass_quad_t quad;
 	krass_draw_callback_t cb;
+	// Assets rendered on the CPU set `fill` instead of `cb`, `pixels` holds them until composited
+	krass_pixels_callback_t fill;
+	uint8_t *pixels;
 	void *data;
+	// Alpha range of the baked pixels, only valid if `measured`
+	uint8_t alpha_min, alpha_max;
+	bool measured;
 } krass_image_t;
 
+// A glyph rasterized by the worker of a glyph cache
+typedef struct krass_glyph_job {
+	int slot;
+	uint32_t codepoint;
+	krass_glyph_metrics_t metrics;
+	bool found;
+} krass_glyph_job_t;
+
+// Slots of `width` x `height` pixels at (x, y) in the block of a font, `columns` of them per row.
+// Queued glyphs are rasterized in batches by one worker at a time
+typedef struct krass_glyph_cache {
+	krass_glyph_slots_t slots;
+	int width, height, columns, x, y;
+	krass_glyph_callback_t cb;
+	void *data;
+	krass_pixel_ops_t ops;
+	krass_glyph_job_t *batch;
+	uint8_t *batch_pixels;
+	int batch_count;
+	kinc_thread_t worker;
+	kinc_mutex_t mutex;
+	bool working, done;
+} krass_glyph_cache_t;
+
+// A font file loaded once for every size reserved from it
+typedef struct krass_font_file {
+	const char *path;
+	int index;
+	kr_ttf_font_t font;
+} krass_font_file_t;
+
 typedef struct krass_font {
 	int pack_id;
 	const char *fontpath;
 	int size;
 	int font_index;
 	kr_ttf_font_t font;
+	// Every glyph is packed into the block of the font on its own
+	krass_glyph_t *glyphs;
+	int glyph_count;
+	// Subset of the baked glyphs to pack, all of them if `set.ranges` is `NULL`
+	krass_glyph_set_t set;
+	int missing;
+	// Slots for glyphs rasterized at runtime, below the baked glyphs
+	krass_glyph_cache_t *cache;
+	// Falloff in pixels of a font baked as a signed distance field, 0 bakes the coverage
+	int spread;
+	// Index into the font files of the context the glyphs are rasterized from
+	int file;
 } krass_font_t;
 
 typedef union krass_data {
@@ -45,24 +107,144 @@ typedef struct krass_asset {
 	krass_data_t data;
 } krass_asset_t;
 
-struct krass_ctx {
+// Fills the pixels of CPU rendered assets on worker threads while the rest of the bake goes on
+typedef struct krass_fill_pool {
+	krass_asset_t *assets;
+	int *ids;
+	int count, next, done;
+	kinc_mutex_t mutex;
+	kinc_thread_t *workers;
+	int worker_count;
+} krass_fill_pool_t;
+
+// Steps every page takes after baking, each one runs in a tick of its own
+typedef enum krass_stage {
+	KRASS_STAGE_READBACK,
+	KRASS_STAGE_PROCESS,
+	KRASS_STAGE_UPLOAD,
+	KRASS_STAGE_MIPMAPS,
+	KRASS_STAGE_COUNT,
+} krass_stage_t;
+
+typedef struct krass_atlas_page {
+	kinc_g4_render_target_t target;
 	kr_image_t *img;
+	// Pages loaded from the cache were never rendered
+	bool has_target;
+	// `img` samples `target` itself, nothing is read back
+	bool direct;
+	// Pixels of the texture of a page holding glyph caches. New glyphs are written here and
+	// `modified` pages are uploaded as a whole
+	uint8_t *copy;
+	size_t copy_bytes;
+	bool modified;
+} krass_atlas_page_t;
+
+struct krass_ctx {
+	krass_atlas_page_t *pages;
+	int page_count;
 	krass_canvas_t canvas;
 	krass_asset_t *assets;
-	kinc_g4_render_target_t target;
+	krass_options_t options;
 	int top, cap, cursor, step, mipmap_levels;
-	bool first;
+	// Asset ids in the order they get rendered, grouped by page
+	int *order;
+	// Assets from `dirty` on are not in the texture yet
+	int dirty;
+	// Pages and layout before a repack, the first `prev_top` assets get copied from there
+	krass_atlas_page_t *prev_pages;
+	int prev_page_count;
+	krass_rect_t *prev_rects;
+	int prev_top;
+	bool baking, repack;
+	// The current bake has its render order and pages, set up once by its first tick
+	bool bake_started;
+	// Page being finished after baking, -1 before the first one. Its pixels are read back in
+	// bands of `band_rows` rows from `band_row` on, each one is processed over several ticks.
+	// `processed` row pairs from the top and bottom of the band are done
+	int finish_page;
+	krass_stage_t stage;
+	uint8_t *pixels;
+	int band_row, band_rows, processed;
+	// Next index into `order` rendered into the current band of a tiled bake, -1 before it starts
+	int band_cursor;
+	// Bands smaller than the page are copied here first to read back no more than the band. A
+	// tiled bake renders every band here instead of into a target per page
+	kinc_g4_render_target_t staging;
+	int staging_samples;
+	bool has_staging;
+	// New texture of the page being finished, stays locked until its last band is uploaded
+	kinc_g4_texture_t upload;
+	uint8_t *locked;
+	// Bytes of pixel data currently allocated and the most at any time
+	size_t pixel_bytes, peak_bytes;
+	krass_fill_pool_t fills;
+	// Image assets of the page being finished, their alpha ranges are gathered while processing
+	krass_pixel_span_t *spans;
+	int span_count;
+	// Rects of the page being finished copied from converted textures, the conversions skip them
+	krass_pixel_rect_t *converted;
+	int converted_count;
+	kinc_file_writer_t cache_writer;
+	bool caching;
+	// Pixel area of the assets in the current bake and how much of it is rendered
+	double bake_area, baked_area;
+	// Moving average of the seconds callbacks take per pixel, predicts the cost of the next asset
+	double pixel_cost;
 #ifdef KR_FULL_RGBA_FONTS
 	int font_count;
+	// Files of the reserved fonts while they are rasterized and baked
+	krass_font_file_t *font_files;
+	int font_file_count;
 #endif
 };
 
+void krass_options_set_defaults(krass_options_t *options) {
+	options->heuristic = KRASS_PACK_MAXRECTS_BEST_SHORT_SIDE;
+	options->sort = KRASS_PACK_SORT_HEIGHT;
+	options->max_size = 16384;
+	options->trial_heuristics = 0;
+	options->trial_sorts = 0;
+	options->pack_threads = 0;
+	options->npot = false;
+	options->cache_path = NULL;
+	options->cache_version = 0;
+	options->zero_readback = false;
+	options->tick_budget = 0.0;
+	options->premultiply_alpha = false;
+	options->swap_red_blue = false;
+	options->band_height = 0;
+	options->tiled_bake = false;
+	options->samples = 1;
+	options->supersample = 1;
+}
+
 krass_ctx_t *krass_init(int reserve, int step, int mipmap_levels) {
+	krass_options_t options;
+	krass_options_set_defaults(&options);
+	return krass_init_with_options(reserve, step, mipmap_levels, &options);
+}
+
+krass_ctx_t *krass_init_with_options(int reserve, int step, int mipmap_levels,
+                                     const krass_options_t *options) {
 	assert(reserve > 0);
+	assert(options != NULL);
 	krass_ctx_t *ctx = (krass_ctx_t *)kr_malloc(sizeof(krass_ctx_t));
 	assert(ctx != NULL);
 	memset(ctx, 0, sizeof(krass_ctx_t));
+	memcpy(&ctx->options, options, sizeof(krass_options_t));
+	if (ctx->options.samples < 1) ctx->options.samples = 1;
+	if (ctx->options.supersample < 1) ctx->options.supersample = 1;
 	krass_pack_init(&ctx->canvas, reserve);
+	ctx->canvas.heuristic = options->heuristic;
+	ctx->canvas.sort = options->sort;
+	ctx->canvas.max_size = (float)options->max_size;
+	ctx->canvas.trial_heuristics = options->trial_heuristics;
+	ctx->canvas.trial_sorts = options->trial_sorts;
+	ctx->canvas.threads = options->pack_threads > 0 ? options->pack_threads : kinc_cpu_cores();
+	ctx->canvas.npot = options->npot && kinc_g4_supports_non_pow2_textures();
+	if (options->npot && !ctx->canvas.npot)
+		kinc_log(KINC_LOG_LEVEL_WARNING, "Non power of two textures unsupported, ignoring npot");
 	ctx->assets = (krass_asset_t *)kr_malloc(reserve * sizeof(krass_asset_t));
 	assert(ctx->assets != NULL);
 	ctx->cap = reserve;
@@ -72,15 +254,82 @@ krass_ctx_t *krass_init(int reserve, int step, int mipmap_levels) {
 	return ctx;
 }
 
+static void free_pixels(krass_ctx_t *ctx, uint8_t *data, size_t bytes);
+
+static void destroy_page(krass_ctx_t *ctx, krass_atlas_page_t *page) {
+	if (page->img != NULL) {
+		// An image wrapping the render target owns nothing itself
+		if (!page->direct) kr_image_destroy(page->img);
+		kr_free(page->img);
+		page->img = NULL;
+	}
+	if (page->has_target) kinc_g4_render_target_destroy(&page->target);
+	page->has_target = false;
+	if (page->copy != NULL) free_pixels(ctx, page->copy, page->copy_bytes);
+	page->copy = NULL;
+	page->copy_bytes = 0;
+}
+
+static void release_previous(krass_ctx_t *ctx) {
+	if (ctx->prev_pages == NULL) return;
+	for (int i = 0; i < ctx->prev_page_count; ++i) destroy_page(ctx, &ctx->prev_pages[i]);
+	kr_free(ctx->prev_pages);
+	kr_free(ctx->prev_rects);
+	ctx->prev_pages = NULL;
+	ctx->prev_page_count = 0;
+	ctx->prev_rects = NULL;
+	ctx->prev_top = 0;
+}
+
+static bool end_fills(krass_fill_pool_t *pool, bool wait);
+static void release_fills(krass_ctx_t *ctx);
+static void destroy_glyph_cache(krass_glyph_cache_t *cache) {
+	if (cache->working) kinc_thread_wait_and_destroy(&cache->worker);
+	if (cache->batch != NULL) kr_free(cache->batch);
+	if (cache->batch_pixels != NULL) kr_free(cache->batch_pixels);
+	kinc_mutex_destroy(&cache->mutex);
+	krass_glyph_slots_destroy(&cache->slots);
+	kr_free(cache);
+}
+
+#ifdef KR_FULL_RGBA_FONTS
+static void close_font_files(krass_ctx_t *ctx) {
+	if (ctx->font_files == NULL) return;
+	for (int i = 0; i < ctx->font_file_count; ++i) kr_ttf_font_destroy(&ctx->font_files[i].font);
+	kr_free(ctx->font_files);
+	ctx->font_files = NULL;
+	ctx->font_file_count = 0;
+}
+#else
+#define close_font_files(ctx)
+#endif
+
 void krass_destroy(krass_ctx_t *ctx) {
-	if (ctx->img != NULL) {
-		kr_image_destroy(ctx->img);
-		kr_free(ctx->img);
+	end_fills(&ctx->fills, true);
+	release_fills(ctx);
+	if (ctx->pixels != NULL) kr_free(ctx->pixels);
+	if (ctx->spans != NULL) kr_free(ctx->spans);
+	if (ctx->converted != NULL) kr_free(ctx->converted);
+	if (ctx->locked != NULL) {
+		kinc_g4_texture_unlock(&ctx->upload);
+		kinc_g4_texture_destroy(&ctx->upload);
 	}
+	if (ctx->has_staging) kinc_g4_render_target_destroy(&ctx->staging);
+	if (ctx->caching) kinc_file_writer_close(&ctx->cache_writer);
+	for (int i = 0; i < ctx->page_count; ++i) destroy_page(ctx, &ctx->pages[i]);
+	if (ctx->pages != NULL) kr_free(ctx->pages);
+	if (ctx->order != NULL) kr_free(ctx->order);
+	release_previous(ctx);
 	krass_pack_destroy(&ctx->canvas);
+	close_font_files(ctx);
 	for (int i = 0; i < ctx->top; ++i) {
 		if (ctx->assets[i].type != KRASS_TYPE_FONT) continue;
 		kr_ttf_font_destroy(&ctx->assets[i].data.font.font);
+		if (ctx->assets[i].data.font.glyphs != NULL) kr_free(ctx->assets[i].data.font.glyphs);
+		if (ctx->assets[i].data.font.set.ranges != NULL)
+			kr_free(ctx->assets[i].data.font.set.ranges);
+		if (ctx->assets[i].data.font.cache != NULL)
+			destroy_glyph_cache(ctx->assets[i].data.font.cache);
 	}
 }
 
@@ -101,6 +350,15 @@ int krass_reserve_quad_font(krass_ctx_t *ctx, const char *fontpath, int size, in
 	}
 	grow_data(ctx);
 	ctx->assets[ctx->top].type = KRASS_TYPE_FONT;
+	ctx->assets[ctx->top].data.font.glyphs = NULL;
+	ctx->assets[ctx->top].data.font.glyph_count = 0;
+	ctx->assets[ctx->top].data.font.set.ranges = NULL;
+	ctx->assets[ctx->top].data.font.set.count = 0;
+	ctx->assets[ctx->top].data.font.missing = 0;
+	ctx->assets[ctx->top].data.font.cache = NULL;
+	ctx->assets[ctx->top].data.font.spread = 0;
+	ctx->assets[ctx->top].data.font.file = -1;
+	kr_ttf_font_init_empty(&ctx->assets[ctx->top].data.font.font);
 	ctx->assets[ctx->top].data.font.fontpath = fontpath;
 	ctx->assets[ctx->top].data.font.size = size;
 	ctx->assets[ctx->top++].data.font.font_index = font_index;
@@ -108,45 +366,120 @@ int krass_reserve_quad_font(krass_ctx_t *ctx, const char *fontpath, int size, in
 	return ctx->top - 1;
 }
 
+int krass_reserve_quad_font_ranges(krass_ctx_t *ctx, const char *fontpath, int size,
+                                   int font_index, const uint32_t *ranges, int range_count) {
+	int id = krass_reserve_quad_font(ctx, fontpath, size, font_index);
+	if (id < 0) return id;
+	krass_glyphs_set_ranges(&ctx->assets[id].data.font.set, ranges, range_count);
+	return id;
+}
+
+int krass_reserve_quad_font_text(krass_ctx_t *ctx, const char *fontpath, int size,
+                                 int font_index, const char *text) {
+	int id = krass_reserve_quad_font(ctx, fontpath, size, font_index);
+	if (id < 0) return id;
+	krass_glyphs_set_text(&ctx->assets[id].data.font.set, text);
+	return id;
+}
+
+bool krass_set_font_sdf(krass_ctx_t *ctx, int id, int spread) {
+	assert(ctx->cap > id && id >= 0);
+	assert(ctx->assets[id].type == KRASS_TYPE_FONT);
+	if (ctx->cursor > -1 || spread < 0) {
+		kinc_log(KINC_LOG_LEVEL_ERROR, "Cannot bake font %d as distance field", id);
+		return false;
+	}
+	ctx->assets[id].data.font.spread = spread;
+	return true;
+}
+
+int krass_get_missing_glyphs(krass_ctx_t *ctx, int id) {
+	assert(ctx->cap > id && id >= 0);
+	assert(ctx->assets[id].type == KRASS_TYPE_FONT);
+	return ctx->assets[id].data.font.missing;
+}
+
 kr_ttf_font_t *krass_get_font(krass_ctx_t *ctx, int id) {
 	assert(ctx->cap > id && id >= 0);
 	assert(ctx->assets[id].type == KRASS_TYPE_FONT);
 	return &ctx->assets[id].data.font.font;
 }
 
+// Every file is read and parsed once, each size reserved from it is loaded into the same font
+static void open_font_files(krass_ctx_t *ctx) {
+	close_font_files(ctx);
+	ctx->font_files = (krass_font_file_t *)kr_malloc(
+	    (ctx->font_count > 0 ? ctx->font_count : 1) * sizeof(krass_font_file_t));
+	assert(ctx->font_files != NULL);
+	for (int i = 0; i < ctx->top; ++i) {
+		if (ctx->assets[i].type != KRASS_TYPE_FONT) continue;
+		krass_font_t *font = &ctx->assets[i].data.font;
+		int k = 0;
+		while (k < ctx->font_file_count && (ctx->font_files[k].index != font->font_index ||
+		                                    strcmp(ctx->font_files[k].path, font->fontpath) != 0))
+			++k;
+		krass_font_file_t *file = &ctx->font_files[k];
+		if (k == ctx->font_file_count) {
+			file->path = font->fontpath;
+			file->index = font->font_index;
+			kr_ttf_font_init(&file->font, font->fontpath, font->font_index);
+			++ctx->font_file_count;
+		}
+		if (internal_glyphs_chars(&file->font, font->size) == NULL)
+			kr_ttf_load(&file->font, font->size);
+		font->file = k;
+	}
+}
+
 static void load_fonts(krass_ctx_t *ctx) {
-	int remaining = ctx->font_count;
-	int cursor = 0;
-	while (remaining > 0) {
-		while (ctx->assets[cursor].type != KRASS_TYPE_FONT) {
-			++cursor;
-			if (cursor >= ctx->cap) {
-				kinc_log(KINC_LOG_LEVEL_ERROR, "Font count appears wrong");
-				return;
-			}
+	if (ctx->font_count == 0) return;
+	open_font_files(ctx);
+	for (int i = 0; i < ctx->top; ++i) {
+		if (ctx->assets[i].type != KRASS_TYPE_FONT) continue;
+		krass_font_t *font = &ctx->assets[i].data.font;
+		int width, height;
+		krass_glyph_set_t *set = font->set.ranges != NULL ? &font->set : NULL;
+		font->glyph_count =
+		    krass_glyphs_layout(&ctx->font_files[font->file].font, font->size, &ctx->canvas, set,
+		                        font->spread, &font->glyphs, &width, &height);
+		uint32_t first = 0;
+		if (set != NULL) font->missing = krass_glyphs_missing(set, font->glyph_count, &first);
+		if (font->missing > 0)
+			kinc_log(KINC_LOG_LEVEL_WARNING, "Font %s misses %d requested glyphs, first U+%04X",
+			         font->fontpath, font->missing, (unsigned)first);
+		krass_glyph_cache_t *cache = font->cache;
+		if (cache != NULL) {
+			int rows = (cache->slots.count + cache->columns - 1) / cache->columns;
+			cache->x = 0;
+			cache->y = height;
+			if (cache->columns * cache->width > width) width = cache->columns * cache->width;
+			height += rows * cache->height;
 		}
-		kr_ttf_font_init(&ctx->assets[cursor].data.font.font,
-		                 ctx->assets[cursor].data.font.fontpath,
-		                 ctx->assets[cursor].data.font.font_index);
-		kr_ttf_load(&ctx->assets[cursor].data.font.font, ctx->assets[cursor].data.font.size);
-		int width = kr_ttf_get_texture(&ctx->assets[cursor].data.font.font,
-		                               ctx->assets[cursor].data.font.size)
-		                ->tex_width;
-		int height = kr_ttf_get_first_unused_y(&ctx->assets[cursor].data.font.font,
-		                                       ctx->assets[cursor].data.font.size);
-		ctx->assets[cursor].data.font.pack_id = krass_pack_add_rect(&ctx->canvas, width, height);
-		--remaining;
+		font->pack_id = krass_pack_add_rect(&ctx->canvas, width, height, false);
 	}
 }
 
-static void render_font(krass_ctx_t *ctx) {
-	krass_font_t *font = &ctx->assets[ctx->cursor].data.font;
+// The baked fonts keep sampling the old pages until they are mapped again
+static void reload_fonts(krass_ctx_t *ctx) {
+	if (ctx->font_count > 0) open_font_files(ctx);
+}
+
+static void render_font(krass_ctx_t *ctx, int id, float oy) {
+	krass_font_t *font = &ctx->assets[id].data.font;
 	krass_rect_t *r = &ctx->canvas.rects[font->pack_id];
-	kinc_g4_texture_t *tex = kr_ttf_get_texture(&font->font, font->size);
+	kinc_g4_texture_t *tex = kr_ttf_get_texture(&ctx->font_files[font->file].font, font->size);
 	kr_image_t img;
 	kr_image_from_texture(&img, tex, tex->tex_width, tex->tex_height);
-	kr_g2_scissor(r->x, r->y, r->w, r->h);
-	kr_g2_draw_scaled_sub_image(&img, 0, 0, r->w, r->h, r->x, r->y, r->w, r->h);
+	float n = (float)ctx->options.supersample;
+	float x = r->x * n;
+	float y = (r->y - oy) * n;
+	kr_g2_scissor(x, y, r->w * n, r->h * n);
+	for (int i = 0; i < font->glyph_count; ++i) {
+		krass_glyph_t *g = &font->glyphs[i];
+		if (g->w == 0 || g->h == 0) continue;
+		kr_g2_draw_scaled_sub_image(&img, (float)g->sx, (float)g->sy, (float)g->w, (float)g->h,
+		                            x + g->x * n, y + g->y * n, g->w * n, g->h * n);
+	}
 	kr_g2_disable_scissor();
 }
 
@@ -164,71 +497,1163 @@ static void map_fonts(krass_ctx_t *ctx) {
 		krass_rect_t *r = &ctx->canvas.rects[font->pack_id];
 		kr_ttf_font_t tmp;
 		kr_ttf_font_init_empty(&tmp);
-		kr_ttf_load_baked_font(&tmp, &font->font, font->size, ctx->img->tex, r->x, r->y, false);
+		kr_ttf_load_baked_font(&tmp, &ctx->font_files[font->file].font, font->size,
+		                       ctx->pages[r->page].img->tex, r->x, r->y, false);
+		krass_glyphs_map(&tmp, font->size, font->glyphs, font->glyph_count, (int)r->x,
+		                 (int)r->y, font->spread);
 		kr_ttf_font_destroy(&font->font);
 		memcpy(&font->font, &tmp, sizeof(kr_ttf_font_t));
 		--remaining;
+		++cursor;
+	}
+	// Loaded again if a repack bakes the fonts once more
+	close_font_files(ctx);
+}
+
+bool krass_reserve_glyph_cache(krass_ctx_t *ctx, int id, krass_dim_t slot, int slots,
+                               krass_glyph_callback_t cb, void *data) {
+	assert(ctx->cap > id && id >= 0);
+	assert(ctx->assets[id].type == KRASS_TYPE_FONT);
+	krass_font_t *font = &ctx->assets[id].data.font;
+	if (ctx->cursor > -1 || font->cache != NULL || slots < 1) {
+		kinc_log(KINC_LOG_LEVEL_ERROR, "Cannot reserve a glyph cache for font %d", id);
+		return false;
+	}
+	krass_glyph_cache_t *cache = (krass_glyph_cache_t *)kr_malloc(sizeof(krass_glyph_cache_t));
+	assert(cache != NULL);
+	krass_glyph_slots_init(&cache->slots, slots);
+	cache->width = slot.width > 1.0f ? (int)ceilf(slot.width) : 1;
+	cache->height = slot.height > 1.0f ? (int)ceilf(slot.height) : 1;
+	// About as wide as high
+	cache->columns = (int)ceilf(sqrtf((float)slots * cache->height / cache->width));
+	if (cache->columns > slots) cache->columns = slots;
+	cache->x = 0;
+	cache->y = 0;
+	cache->cb = cb;
+	cache->data = data;
+	cache->ops.premultiply = ctx->options.premultiply_alpha;
+	cache->ops.swap_red_blue = ctx->options.swap_red_blue;
+	cache->ops.skip = NULL;
+	cache->ops.skip_count = 0;
+	cache->batch = NULL;
+	cache->batch_pixels = NULL;
+	cache->batch_count = 0;
+	cache->working = false;
+	cache->done = false;
+	kinc_mutex_init(&cache->mutex);
+	font->cache = cache;
+	return true;
+}
+
+static bool page_has_glyph_cache(krass_ctx_t *ctx, int page) {
+	for (int i = 0; i < ctx->top; ++i) {
+		krass_font_t *font = &ctx->assets[i].data.font;
+		if (ctx->assets[i].type != KRASS_TYPE_FONT || font->cache == NULL) continue;
+		if (ctx->canvas.rects[font->pack_id].page == page) return true;
+	}
+	return false;
+}
+
+// The page got a texture without the glyphs rasterized so far
+static void reset_glyph_caches(krass_ctx_t *ctx, int page) {
+	for (int i = 0; i < ctx->top; ++i) {
+		krass_font_t *font = &ctx->assets[i].data.font;
+		if (ctx->assets[i].type != KRASS_TYPE_FONT || font->cache == NULL) continue;
+		if (ctx->canvas.rects[font->pack_id].page == page)
+			krass_glyph_slots_clear(&font->cache->slots);
+	}
+}
+
+// Index of `codepoint` among the baked glyphs of `font`, -1 if it was not baked
+static int baked_index(krass_font_t *font, uint32_t codepoint) {
+	uint32_t index = codepoint - KRASS_GLYPHS_FIRST;
+	if (codepoint >= KRASS_GLYPHS_FIRST && index < (uint32_t)font->glyph_count &&
+	    (font->set.ranges == NULL || internal_glyphs_contains(&font->set, codepoint)))
+		return (int)index;
+	return -1;
+}
+
+// Slot holding the pixels of `codepoint` in the glyph cache of `font`, -1 while there is none
+static int cached_slot(krass_ctx_t *ctx, krass_font_t *font, uint32_t codepoint) {
+	krass_glyph_cache_t *cache = font->cache;
+	// Slots move while the context bakes
+	if (cache == NULL || ctx->baking || ctx->pages == NULL) return -1;
+	int i = krass_glyph_slots_acquire(&cache->slots, codepoint);
+	if (i < 0 || cache->slots.slots[i].state != KRASS_SLOT_READY) return -1;
+	return i;
+}
+
+// Texture coordinates of the `width` x `height` pixels at `sx`, `sy` on the page of `font`
+static void glyph_coords(krass_ctx_t *ctx, krass_font_t *font, float sx, float sy, float width,
+                         float height, kr_ttf_aligned_quad_t *quad) {
+	krass_page_t *page = &ctx->canvas.pages[ctx->canvas.rects[font->pack_id].page];
+	quad->s0 = sx / page->w;
+	quad->t0 = sy / page->h;
+	quad->s1 = (sx + width) / page->w;
+	quad->t1 = (sy + height) / page->h;
+}
+
+// Texture coordinates of the pixels in glyph cache slot `i`
+static void slot_coords(krass_ctx_t *ctx, krass_font_t *font, int i,
+                        kr_ttf_aligned_quad_t *quad) {
+	krass_glyph_cache_t *cache = font->cache;
+	krass_glyph_metrics_t *m = &cache->slots.slots[i].metrics;
+	krass_rect_t *r = &ctx->canvas.rects[font->pack_id];
+	float sx = r->x + (float)(cache->x + i % cache->columns * cache->width);
+	float sy = r->y + (float)(cache->y + i / cache->columns * cache->height);
+	glyph_coords(ctx, font, sx, sy, (float)m->width, (float)m->height, quad);
+}
+
+bool krass_get_glyph(krass_ctx_t *ctx, int id, uint32_t codepoint, kr_ttf_aligned_quad_t *quad,
+                     float x, float y) {
+	assert(ctx->cap > id && id >= 0);
+	assert(ctx->assets[id].type == KRASS_TYPE_FONT);
+	krass_font_t *font = &ctx->assets[id].data.font;
+	int index = baked_index(font, codepoint);
+	if (index > -1) return kr_ttf_get_baked_quad(&font->font, font->size, quad, index, x, y);
+	int i = cached_slot(ctx, font, codepoint);
+	if (i < 0) return false;
+	krass_glyph_metrics_t *m = &font->cache->slots.slots[i].metrics;
+	slot_coords(ctx, font, i, quad);
+	quad->x0 = floorf(x + m->xoff + 0.5f);
+	quad->y0 = floorf(y + m->yoff + 0.5f);
+	quad->x1 = quad->x0 + (float)m->width;
+	quad->y1 = quad->y0 + (float)m->height;
+	quad->xadvance = m->xadvance;
+	return true;
+}
+
+// Both paths scale the unrounded offsets, snapping at the baked size would be off by up to half a
+// pixel times the scale
+bool krass_get_glyph_scaled(krass_ctx_t *ctx, int id, uint32_t codepoint,
+                            kr_ttf_aligned_quad_t *quad, float x, float y, float size) {
+	assert(ctx->cap > id && id >= 0);
+	assert(ctx->assets[id].type == KRASS_TYPE_FONT);
+	krass_font_t *font = &ctx->assets[id].data.font;
+	float scale = size / (float)font->size;
+	float xoff, yoff, width, height, xadvance;
+	int index = baked_index(font, codepoint);
+	if (index > -1) {
+		krass_baked_char_t *chars = internal_glyphs_chars(&font->font, font->size);
+		if (chars == NULL) return false;
+		krass_baked_char_t *c = &chars[index];
+		xoff = c->xoff;
+		yoff = c->yoff;
+		width = (float)(c->x1 - c->x0);
+		height = (float)(c->y1 - c->y0);
+		xadvance = c->xadvance;
+		glyph_coords(ctx, font, (float)c->x0, (float)c->y0, width, height, quad);
+	}
+	else {
+		int i = cached_slot(ctx, font, codepoint);
+		if (i < 0) return false;
+		krass_glyph_metrics_t *m = &font->cache->slots.slots[i].metrics;
+		xoff = m->xoff;
+		yoff = m->yoff;
+		width = (float)m->width;
+		height = (float)m->height;
+		xadvance = m->xadvance;
+		slot_coords(ctx, font, i, quad);
+	}
+	quad->x0 = x + xoff * scale;
+	quad->y0 = y + yoff * scale;
+	quad->x1 = quad->x0 + width * scale;
+	quad->y1 = quad->y0 + height * scale;
+	quad->xadvance = xadvance * scale;
+	return true;
+}
+
+static bool page_has_sdf_font(krass_ctx_t *ctx, int page) {
+	for (int i = 0; i < ctx->top; ++i) {
+		krass_font_t *font = &ctx->assets[i].data.font;
+		if (ctx->assets[i].type != KRASS_TYPE_FONT || font->spread == 0) continue;
+		if (ctx->canvas.rects[font->pack_id].page == page) return true;
+	}
+	return false;
+}
+
+// The render target only has the coverage, the whole page is at hand to turn the glyphs of
+// distance field fonts into fields. A field read back again stays the same
+static void convert_sdf_fonts(krass_ctx_t *ctx, int page, uint8_t *pixels, int width) {
+	for (int i = 0; i < ctx->top; ++i) {
+		krass_font_t *font = &ctx->assets[i].data.font;
+		if (ctx->assets[i].type != KRASS_TYPE_FONT || font->spread == 0) continue;
+		krass_rect_t *r = &ctx->canvas.rects[font->pack_id];
+		if (r->page != page) continue;
+		int pad = font->spread;
+		size_t floats = 1;
+		for (int k = 0; k < font->glyph_count; ++k) {
+			krass_glyph_t *g = &font->glyphs[k];
+			size_t need = krass_pixels_sdf_scratch(g->w + 2 * pad, g->h + 2 * pad);
+			if (need > floats) floats = need;
+		}
+		float *scratch = (float *)kr_malloc(floats * sizeof(float));
+		assert(scratch != NULL);
+		for (int k = 0; k < font->glyph_count; ++k) {
+			krass_glyph_t *g = &font->glyphs[k];
+			if (g->w == 0 || g->h == 0) continue;
+			krass_pixels_sdf(pixels, width * 4, (int)r->x + g->x - pad, (int)r->y + g->y - pad,
+			                 g->w + 2 * pad, g->h + 2 * pad, font->spread,
+			                 ctx->options.premultiply_alpha, scratch);
+		}
+		kr_free(scratch);
+	}
+}
+
+static void glyph_work(void *param) {
+	krass_glyph_cache_t *cache = (krass_glyph_cache_t *)param;
+	int w = cache->width;
+	int h = cache->height;
+	for (int i = 0; i < cache->batch_count; ++i) {
+		krass_glyph_job_t *job = &cache->batch[i];
+		uint8_t *pixels = cache->batch_pixels + (size_t)i * w * h * 4;
+		job->found = cache->cb(job->codepoint, pixels, w, h, w * 4, &job->metrics, cache->data);
+		if (job->found)
+			krass_pixels_process(pixels, w, h, 0, 0, (h + 1) / 2, false, &cache->ops, NULL, 0);
+	}
+	kinc_mutex_lock(&cache->mutex);
+	cache->done = true;
+	kinc_mutex_unlock(&cache->mutex);
+}
+
+// Writes the finished batch into the copy of the page, glyphs evicted in the meantime are dropped
+static void store_glyphs(krass_ctx_t *ctx, krass_font_t *font) {
+	krass_glyph_cache_t *cache = font->cache;
+	krass_rect_t *r = &ctx->canvas.rects[font->pack_id];
+	krass_atlas_page_t *page = &ctx->pages[r->page];
+	assert(page->copy != NULL);
+	int pitch = (int)ctx->canvas.pages[r->page].w * 4;
+	int w = cache->width;
+	int h = cache->height;
+	for (int i = 0; i < cache->batch_count; ++i) {
+		krass_glyph_job_t *job = &cache->batch[i];
+		krass_glyph_slot_t *slot = &cache->slots.slots[job->slot];
+		if (slot->codepoint != job->codepoint || slot->state != KRASS_SLOT_BUSY) continue;
+		if (!job->found) {
+			slot->state = KRASS_SLOT_MISSING;
+			continue;
+		}
+		slot->metrics = job->metrics;
+		if (slot->metrics.width > w) slot->metrics.width = w;
+		if (slot->metrics.height > h) slot->metrics.height = h;
+		slot->state = KRASS_SLOT_READY;
+		int x = (int)r->x + cache->x + job->slot % cache->columns * w;
+		int y = (int)r->y + cache->y + job->slot / cache->columns * h;
+		const uint8_t *src = cache->batch_pixels + (size_t)i * w * h * 4;
+		for (int row = 0; row < h; ++row)
+			memcpy(page->copy + (size_t)(y + row) * pitch + x * 4, src + row * w * 4, w * 4);
+		page->modified = true;
+	}
+	kr_free(cache->batch);
+	kr_free(cache->batch_pixels);
+	cache->batch = NULL;
+	cache->batch_pixels = NULL;
+	cache->batch_count = 0;
+}
+
+// Hands the queued glyphs to a new worker
+static void start_glyphs(krass_glyph_cache_t *cache) {
+	int count = 0;
+	for (int i = 0; i < cache->slots.count; ++i) {
+		if (cache->slots.slots[i].state == KRASS_SLOT_QUEUED) ++count;
+	}
+	if (count == 0) return;
+	size_t bytes = (size_t)count * cache->width * cache->height * 4;
+	cache->batch = (krass_glyph_job_t *)kr_malloc(count * sizeof(krass_glyph_job_t));
+	assert(cache->batch != NULL);
+	cache->batch_pixels = (uint8_t *)kr_malloc(bytes);
+	assert(cache->batch_pixels != NULL);
+	memset(cache->batch_pixels, 0, bytes);
+	for (int i = 0; i < cache->slots.count; ++i) {
+		krass_glyph_slot_t *slot = &cache->slots.slots[i];
+		if (slot->state != KRASS_SLOT_QUEUED) continue;
+		krass_glyph_job_t *job = &cache->batch[cache->batch_count++];
+		job->slot = i;
+		job->codepoint = slot->codepoint;
+		slot->state = KRASS_SLOT_BUSY;
+	}
+	cache->done = false;
+	cache->working = true;
+	kinc_thread_init(&cache->worker, glyph_work, cache);
+}
+
+void krass_update_glyphs(krass_ctx_t *ctx) {
+	if (ctx->baking || ctx->pages == NULL) return;
+	for (int i = 0; i < ctx->top; ++i) {
+		krass_font_t *font = &ctx->assets[i].data.font;
+		if (ctx->assets[i].type != KRASS_TYPE_FONT || font->cache == NULL) continue;
+		krass_glyph_cache_t *cache = font->cache;
+		if (cache->working) {
+			kinc_mutex_lock(&cache->mutex);
+			bool done = cache->done;
+			kinc_mutex_unlock(&cache->mutex);
+			if (done) {
+				kinc_thread_wait_and_destroy(&cache->worker);
+				cache->working = false;
+				store_glyphs(ctx, font);
+			}
+		}
+		if (!cache->working) start_glyphs(cache);
+		++cache->slots.frame;
+	}
+	// Locking discards the texture on some backends, the whole page is written again
+	for (int i = 0; i < ctx->page_count; ++i) {
+		krass_atlas_page_t *page = &ctx->pages[i];
+		if (!page->modified) continue;
+		kinc_g4_texture_t *tex = page->img->tex;
+		int width = (int)ctx->canvas.pages[i].w;
+		int height = (int)ctx->canvas.pages[i].h;
+		uint8_t *locked = kinc_g4_texture_lock(tex);
+		int stride = kinc_g4_texture_stride(tex);
+		for (int y = 0; y < height; ++y)
+			memcpy(locked + (size_t)y * stride, page->copy + (size_t)y * width * 4, width * 4);
+		kinc_g4_texture_unlock(tex);
+		kr_image_generate_mipmaps(page->img, ctx->mipmap_levels);
+		page->modified = false;
 	}
 }
 #else
 #define krass_reserve_quad_font(ctx, fontpath, size, font_index) -1
+#define krass_reserve_quad_font_ranges(ctx, fontpath, size, font_index, ranges, range_count) -1
+#define krass_reserve_quad_font_text(ctx, fontpath, size, font_index, text) -1
+#define krass_get_missing_glyphs(ctx, id) 0
 #define krass_get_font(ctx, id) NULL
+#define krass_reserve_glyph_cache(ctx, id, slot, slots, cb, data) false
+#define page_has_glyph_cache(ctx, page) false
+#define reset_glyph_caches(ctx, page)
+#define krass_get_glyph(ctx, id, codepoint, quad, x, y) false
+#define krass_set_font_sdf(ctx, id, spread) false
+#define krass_get_glyph_scaled(ctx, id, codepoint, quad, x, y, size) false
+#define page_has_sdf_font(ctx, page) false
+#define convert_sdf_fonts(ctx, page, pixels, width)
+#define krass_update_glyphs(ctx)
 #define load_fonts(ctx)
-#define render_font(ctx)
+#define reload_fonts(ctx)
+#define render_font(ctx, id, oy)
 #define map_fonts(ctx)
 #endif
 
 void krass_finalize(krass_ctx_t *ctx) {
+	krass_finalize_with_budget(ctx, 0.0);
+}
+
+static bool load_cache(krass_ctx_t *ctx);
+static void begin_fills(krass_ctx_t *ctx);
+
+void krass_finalize_with_budget(krass_ctx_t *ctx, double budget) {
 	load_fonts(ctx);
-	krass_pack_compute(&ctx->canvas);
+	ctx->dirty = 0;
+	ctx->baking = true;
+	if (ctx->options.cache_path != NULL && load_cache(ctx)) {
+		// Nothing left to bake, the next tick maps the fonts
+		ctx->cursor = ctx->top + 1;
+		return;
+	}
+	// Files are decoded while packing
+	begin_fills(ctx);
+	krass_pack_compute(&ctx->canvas, budget);
 	ctx->cursor = 0;
 }
 
-static void render_image(krass_ctx_t *ctx) {
-	krass_image_t *img = &ctx->assets[ctx->cursor].data.image;
+static void repack(krass_ctx_t *ctx) {
+	if (ctx->pages != NULL) {
+		// Previously baked images are copied from the old pages, fonts get rendered again. Direct
+		// pages keep their render target until the copies are done
+		for (int i = 0; i < ctx->page_count; ++i) {
+			krass_atlas_page_t *page = &ctx->pages[i];
+			if (!page->has_target || page->direct) continue;
+			kinc_g4_render_target_destroy(&page->target);
+			page->has_target = false;
+		}
+		ctx->prev_pages = ctx->pages;
+		ctx->prev_page_count = ctx->page_count;
+		ctx->pages = NULL;
+		ctx->page_count = 0;
+		ctx->prev_top = ctx->dirty;
+		ctx->prev_rects = (krass_rect_t *)kr_malloc(ctx->canvas.top * sizeof(krass_rect_t));
+		assert(ctx->prev_rects != NULL);
+		memcpy(ctx->prev_rects, ctx->canvas.rects, ctx->canvas.top * sizeof(krass_rect_t));
+		reload_fonts(ctx);
+	}
+	krass_pack_compute(&ctx->canvas, 0.0);
+	ctx->dirty = 0;
+	ctx->repack = false;
+}
+
+static krass_rect_t *asset_rect(krass_ctx_t *ctx, int id) {
+	if (ctx->assets[id].type == KRASS_TYPE_FONT)
+		return &ctx->canvas.rects[ctx->assets[id].data.font.pack_id];
+	return &ctx->canvas.rects[ctx->assets[id].data.image.pack_id];
+}
+
+// Baked fonts need a texture, CPU filled assets are composited into the read back pixels
+static bool page_needs_texture(krass_ctx_t *ctx, int page) {
+	for (int id = 0; id < ctx->top; ++id) {
+		krass_asset_t *asset = &ctx->assets[id];
+		if (asset->type == KRASS_TYPE_IMAGE && asset->data.image.fill == NULL) continue;
+		if (asset_rect(ctx, id)->page == page) return true;
+	}
+	return false;
+}
+
+static void begin_bake(krass_ctx_t *ctx) {
+	ctx->bake_started = true;
+	ctx->finish_page = -1;
+	ctx->stage = KRASS_STAGE_READBACK;
+	ctx->band_cursor = -1;
+	bool tiled = ctx->options.tiled_bake;
+	int n = ctx->options.supersample;
+	if (ctx->pages == NULL) {
+		ctx->page_count = ctx->canvas.page_count;
+		ctx->pages =
+		    (krass_atlas_page_t *)kr_malloc(ctx->page_count * sizeof(krass_atlas_page_t));
+		assert(ctx->pages != NULL);
+		for (int i = 0; i < ctx->page_count; ++i) {
+			krass_page_t *page = &ctx->canvas.pages[i];
+			ctx->pages[i].img = NULL;
+			ctx->pages[i].copy = NULL;
+			ctx->pages[i].copy_bytes = 0;
+			ctx->pages[i].modified = false;
+			ctx->pages[i].has_target = !tiled;
+			// Supersampled pages only get their final size on the CPU, they are read back too
+			ctx->pages[i].direct = ctx->options.zero_readback && !tiled && n == 1 &&
+			                       !page_needs_texture(ctx, i);
+			if (tiled) continue;
+			kinc_g4_render_target_init_with_multisampling(
+			    &ctx->pages[i].target, (int)page->w * n, (int)page->h * n,
+			    KINC_G4_RENDER_TARGET_FORMAT_32BIT, 0, 0, ctx->options.samples);
+			kinc_g4_render_target_t *t = {&ctx->pages[i].target};
+			kinc_g4_set_render_targets(&t, 1);
+			kinc_g4_clear(KINC_G4_CLEAR_COLOR, 0x0, -1, 0);
+			kinc_g4_restore_render_target();
+		}
+	}
+	if (ctx->top == 0) return;
+	if (ctx->order == NULL)
+		ctx->order = (int *)kr_malloc(ctx->top * sizeof(int));
+	else
+		ctx->order = (int *)kr_realloc(ctx->order, ctx->top * sizeof(int));
+	assert(ctx->order != NULL);
+	ctx->bake_area = 0.0;
+	ctx->baked_area = 0.0;
+	for (int id = ctx->dirty; id < ctx->top; ++id) {
+		krass_rect_t *r = asset_rect(ctx, id);
+		ctx->bake_area += (double)r->w * (double)r->h;
+	}
+	// Render page by page to switch render targets as rarely as possible
+	int k = ctx->dirty;
+	for (int page = 0; page < ctx->page_count; ++page) {
+		for (int id = ctx->dirty; id < ctx->top; ++id) {
+			if (asset_rect(ctx, id)->page == page) ctx->order[k++] = id;
+		}
+	}
+	// Assets are rendered band by band while finishing the pages
+	if (tiled) ctx->cursor = ctx->top;
+}
+
+static void begin_page(krass_ctx_t *ctx, int page) {
+	kinc_g4_render_target_t *t = {&ctx->pages[page].target};
+	kinc_g4_set_render_targets(&t, 1);
+	kr_g2_begin(0);
+	int n = ctx->options.supersample;
+	kr_g2_set_render_target_dim((int)ctx->canvas.pages[page].w * n,
+	                            (int)ctx->canvas.pages[page].h * n);
+}
+
+static void end_page(void) {
+	kr_g2_reset_render_target_dim();
+	kr_g2_end();
+	kinc_g4_restore_render_target();
+}
+
+// Draws the asset stored at `src` upright into the destination quad
+static void draw_rect(kr_image_t *img, const krass_rect_t *src, float dx, float dy, float dw,
+                      float dh) {
+	if (!src->rotated) {
+		kr_g2_draw_scaled_sub_image(img, src->x, src->y, src->w, src->h, dx, dy, dw, dh);
+		return;
+	}
+	// Draw the stored quad as is, then turn it back around the center of its top left square
+	kr_g2_push_rotation(-KRASS_QUARTER_TURN, dx + dh * 0.5f, dy + dh * 0.5f);
+	kr_g2_draw_scaled_sub_image(img, src->x, src->y, src->h, src->w, dx, dy, dh, dw);
+	kr_g2_pop_transform();
+}
+
+// Assets are rendered `oy` pixels higher up than their rect when baking in bands
+static void render_image(krass_ctx_t *ctx, int id, float oy) {
+	krass_image_t *img = &ctx->assets[id].data.image;
 	krass_rect_t *r = &ctx->canvas.rects[img->pack_id];
-	kr_g2_scissor(r->x, r->y, r->w, r->h);
-	img->cb(ctx->cursor, r->x, r->y, img->data);
+	bool copy = id < ctx->prev_top;
+	// Composited into the pixels after the readback, unless only the previous texture has them
+	if (img->fill != NULL && (!copy || img->pixels != NULL)) return;
+	// Render target pixels, `supersample` times the atlas pixels the callbacks draw in
+	float n = (float)ctx->options.supersample;
+	float x = r->x * n;
+	float y = (r->y - oy) * n;
+	float w = r->w * n;
+	float h = r->h * n;
+	if (!copy && n > 1.0f) kr_g2_push_scale(n, n);
+	if (r->rotated) {
+		// The callback draws upright at (x, y), a quarter turn around the center of the top left
+		// square lands it inside the rotated rect
+		kr_g2_scissor(x, y, h, w);
+		kr_g2_push_rotation(KRASS_QUARTER_TURN, x + h * 0.5f, y + h * 0.5f);
+	}
+	else
+		kr_g2_scissor(x, y, w, h);
+	if (copy) {
+		krass_rect_t *src = &ctx->prev_rects[img->pack_id];
+		draw_rect(ctx->prev_pages[src->page].img, src, x, y, w, h);
+	}
+	else
+		img->cb(id, r->x, r->y - oy, img->data);
+	if (r->rotated) kr_g2_pop_transform();
+	if (!copy && n > 1.0f) kr_g2_pop_transform();
 	kr_g2_disable_scissor();
 }
 
-static uint8_t *invert_pixels(uint8_t *data, int width, int height) {
-	uint8_t *inverted_pixels = (uint8_t *)kr_malloc(width * height * 4);
-	assert(inverted_pixels != NULL);
-	for (int y = 0; y < height; ++y) {
-		for (int x = 0; x < width; ++x) {
-			for (int c = 0; c < 4; ++c) {
-				inverted_pixels[y * width * 4 + x * 4 + c] =
-				    data[(height - 1 - y) * width * 4 + x * 4 + c];
-			}
-		}
+// Renders one asset and updates the per pixel cost that predicts the next one
+static void render_asset(krass_ctx_t *ctx, int id, float oy) {
+	krass_rect_t *r = asset_rect(ctx, id);
+	double area = (double)r->w * (double)r->h;
+	double before = kinc_time();
+	if (ctx->assets[id].type == KRASS_TYPE_FONT)
+		render_font(ctx, id, oy);
+	else if (ctx->assets[id].type == KRASS_TYPE_IMAGE)
+		render_image(ctx, id, oy);
+	if (area > 0.0) {
+		double cost = (kinc_time() - before) / area;
+		ctx->pixel_cost = ctx->pixel_cost > 0.0 ? 0.8 * ctx->pixel_cost + 0.2 * cost : cost;
 	}
-	kr_free(data);
-	return inverted_pixels;
+	ctx->baked_area += area;
+}
+
+// Whether the tick started at `start` is done before rendering its `i`th asset covering `area`
+// pixels. Always makes progress, then stops before the next asset is expected to overrun
+static bool tick_full(krass_ctx_t *ctx, double start, int i, double area) {
+	double budget = ctx->options.tick_budget;
+	if (budget <= 0.0) return i >= ctx->step;
+	return i > 0 && kinc_time() - start + area * ctx->pixel_cost > budget;
+}
+
+// Makes `staging` a target of the given size and samples, keeping it if it already fits
+static void use_staging(krass_ctx_t *ctx, int width, int rows, int samples) {
+	if (ctx->has_staging && (ctx->staging.width != width || ctx->staging.height != rows ||
+	                         ctx->staging_samples != samples)) {
+		kinc_g4_render_target_destroy(&ctx->staging);
+		ctx->has_staging = false;
+	}
+	if (!ctx->has_staging) {
+		kinc_g4_render_target_init_with_multisampling(
+		    &ctx->staging, width, rows, KINC_G4_RENDER_TARGET_FORMAT_32BIT, 0, 0, samples);
+		ctx->staging_samples = samples;
+		ctx->has_staging = true;
+	}
+}
+
+// Renders the assets overlapping the current band of a tiled page into `staging`, on top of the
+// band of its previous texture. Returns false if the tick ran out before the band is complete
+static bool render_band(krass_ctx_t *ctx, int page) {
+	int width = (int)ctx->canvas.pages[page].w;
+	int n = ctx->options.supersample;
+	float top = (float)ctx->band_row;
+	float bottom = top + (float)ctx->band_rows;
+	kinc_g4_render_target_t *t = {&ctx->staging};
+	bool first = ctx->band_cursor < 0;
+	if (first) {
+		use_staging(ctx, width * n, ctx->band_rows * n, ctx->options.samples);
+		ctx->band_cursor = ctx->dirty;
+	}
+	kinc_g4_set_render_targets(&t, 1);
+	if (first) kinc_g4_clear(KINC_G4_CLEAR_COLOR, 0x0, -1, 0);
+	kr_g2_begin(0);
+	kr_g2_set_render_target_dim(width * n, ctx->band_rows * n);
+	kr_image_t *prev = ctx->pages[page].img;
+	if (first && prev != NULL)
+		kr_g2_draw_scaled_sub_image(prev, 0, top, (float)width, (float)ctx->band_rows, 0, 0,
+		                            (float)(width * n), (float)(ctx->band_rows * n));
+	double start = kinc_time();
+	int rendered = 0;
+	for (; ctx->band_cursor < ctx->top; ++ctx->band_cursor) {
+		int id = ctx->order[ctx->band_cursor];
+		krass_rect_t *r = asset_rect(ctx, id);
+		float y1 = r->y + (r->rotated ? r->w : r->h);
+		if (r->page != page || r->y >= bottom || y1 <= top) continue;
+		if (tick_full(ctx, start, rendered, (double)r->w * (double)r->h)) break;
+		render_asset(ctx, id, top);
+		++rendered;
+	}
+	end_page();
+	if (ctx->band_cursor < ctx->top) return false;
+	ctx->band_cursor = -1;
+	return true;
 }
 
-static void create_texture(krass_ctx_t *ctx) {
-	int width = (int)ctx->canvas.w;
-	int height = (int)ctx->canvas.h;
-	uint8_t *data = (uint8_t *)kr_malloc(width * height * 4);
+static uint8_t *alloc_pixels(krass_ctx_t *ctx, size_t bytes) {
+	uint8_t *data = (uint8_t *)kr_malloc(bytes);
 	assert(data != NULL);
-	kinc_g4_render_target_get_pixels(&ctx->target, data);
+	ctx->pixel_bytes += bytes;
+	if (ctx->pixel_bytes > ctx->peak_bytes) ctx->peak_bytes = ctx->pixel_bytes;
+	return data;
+}
+
+static void free_pixels(krass_ctx_t *ctx, uint8_t *data, size_t bytes) {
+	kr_free(data);
+	ctx->pixel_bytes -= bytes;
+}
+
+// Reads back the whole target and restores the render target
+static void read_target(kinc_g4_render_target_t *target, uint8_t *data) {
+	kinc_g4_render_target_get_pixels(target, data);
 	kinc_g4_restore_render_target();
-	if (kinc_g4_render_targets_inverted_y()) data = invert_pixels(data, width, height);
-#ifndef NDEBUG
-	stbi_write_png("test.png", width, height, 4, data, width * 4);
-#endif
+}
+
+// Reads back rows [row, row + rows) of the page, bottom up if render targets are inverted.
+// Supersampled pixels are averaged down in place, the buffer then shrinks to the band
+static uint8_t *read_band(krass_ctx_t *ctx, int page, int row, int rows) {
+	int n = ctx->options.supersample;
+	int width = (int)ctx->canvas.pages[page].w * n;
+	int height = (int)ctx->canvas.pages[page].h * n;
+	size_t bytes = (size_t)width * rows * n * 4;
+	uint8_t *data = alloc_pixels(ctx, bytes);
+	if (ctx->options.tiled_bake) {
+		// The band was rendered into `staging` directly
+		read_target(&ctx->staging, data);
+	}
+	else if (rows * n == height) {
+		read_target(&ctx->pages[page].target, data);
+	}
+	else {
+		// There is no readback of a region, copy the band into a target of its size first
+		use_staging(ctx, width, rows * n, 1);
+		kr_image_t src;
+		kr_image_from_render_target(&src, &ctx->pages[page].target, (float)width,
+		                            (float)height);
+		kinc_g4_render_target_t *t = {&ctx->staging};
+		kinc_g4_set_render_targets(&t, 1);
+		kinc_g4_clear(KINC_G4_CLEAR_COLOR, 0x0, -1, 0);
+		kr_g2_begin(0);
+		kr_g2_set_render_target_dim(width, rows * n);
+		kr_g2_draw_scaled_sub_image(&src, 0, (float)(row * n), (float)width, (float)(rows * n),
+		                            0, 0, (float)width, (float)(rows * n));
+		end_page();
+		read_target(&ctx->staging, data);
+	}
+	if (n == 1) return data;
+	krass_pixels_downsample(data, width / n, rows, n);
+	size_t band = bytes / ((size_t)n * n);
+	data = (uint8_t *)kr_realloc(data, band);
+	assert(data != NULL);
+	ctx->pixel_bytes -= bytes - band;
+	return data;
+}
+
+// Starts a new texture for the page, it is filled band by band while locked. Pages holding glyph
+// caches keep a copy of the pixels
+static void begin_upload(krass_ctx_t *ctx, int page) {
+	int width = (int)ctx->canvas.pages[page].w;
+	int height = (int)ctx->canvas.pages[page].h;
+	kinc_g4_texture_init(&ctx->upload, width, height, KINC_IMAGE_FORMAT_RGBA32);
+	ctx->locked = kinc_g4_texture_lock(&ctx->upload);
+	krass_atlas_page_t *p = &ctx->pages[page];
+	size_t bytes = page_has_glyph_cache(ctx, page) ? (size_t)width * height * 4 : 0;
+	if (p->copy_bytes == bytes) return;
+	if (p->copy != NULL) free_pixels(ctx, p->copy, p->copy_bytes);
+	p->copy = bytes > 0 ? alloc_pixels(ctx, bytes) : NULL;
+	p->copy_bytes = bytes;
+}
+
+static void upload_rows(krass_ctx_t *ctx, int page, const uint8_t *data, int width, int row,
+                        int rows) {
+	int stride = kinc_g4_texture_stride(&ctx->upload);
+	for (int y = 0; y < rows; ++y)
+		memcpy(ctx->locked + (row + y) * stride, data + y * width * 4, width * 4);
+	uint8_t *copy = ctx->pages[page].copy;
+	if (copy != NULL) memcpy(copy + (size_t)row * width * 4, data, (size_t)rows * width * 4);
+}
+
+// Unlocks the new texture and puts it in place. A page that already had a texture keeps its
+// `kinc_g4_texture_t`, fonts mapped to it stay valid
+static void end_upload(krass_ctx_t *ctx, int page) {
+	kinc_g4_texture_unlock(&ctx->upload);
+	ctx->locked = NULL;
+	ctx->pages[page].modified = false;
+	reset_glyph_caches(ctx, page);
+	kr_image_t *atlas = ctx->pages[page].img;
+	if (atlas != NULL) {
+		kinc_g4_texture_destroy(atlas->tex);
+		memcpy(atlas->tex, &ctx->upload, sizeof(kinc_g4_texture_t));
+		return;
+	}
 	kinc_g4_texture_t *tex = (kinc_g4_texture_t *)kr_malloc(sizeof(kinc_g4_texture_t));
 	assert(tex != NULL);
-	kinc_image_t img;
-	kinc_image_init_from_bytes(&img, data, width, height, KINC_IMAGE_FORMAT_RGBA32);
-	kinc_g4_texture_init_from_image(tex, &img);
-	kinc_image_destroy(&img);
-	kr_free(data);
-	ctx->img = (kr_image_t *)kr_malloc(sizeof(kr_image_t));
-	assert(ctx->img != NULL);
-	kr_image_from_texture(ctx->img, tex, (float)width, (float)height);
-	kr_image_generate_mipmaps(ctx->img, ctx->mipmap_levels);
+	memcpy(tex, &ctx->upload, sizeof(kinc_g4_texture_t));
+	atlas = (kr_image_t *)kr_malloc(sizeof(kr_image_t));
+	assert(atlas != NULL);
+	kr_image_from_texture(atlas, tex, ctx->canvas.pages[page].w, ctx->canvas.pages[page].h);
+	ctx->pages[page].img = atlas;
+}
+
+static void wrap_target(krass_ctx_t *ctx, int page) {
+	kr_image_t *atlas = (kr_image_t *)kr_malloc(sizeof(kr_image_t));
+	assert(atlas != NULL);
+	kr_image_from_render_target(atlas, &ctx->pages[page].target, ctx->canvas.pages[page].w,
+	                            ctx->canvas.pages[page].h);
+	ctx->pages[page].img = atlas;
+}
+
+static bool page_is_dirty(krass_ctx_t *ctx, int page) {
+	for (int id = ctx->dirty; id < ctx->top; ++id) {
+		if (asset_rect(ctx, id)->page == page) return true;
+	}
+	return false;
+}
+
+// Kinc makes no thread safety guarantees for loading images, workers decode one file at a time
+// and only scale in parallel. Set up by the main thread before the first workers start
+static kinc_mutex_t decode_mutex;
+static bool decode_mutex_ready = false;
+
+// Decodes the image file in `data` and scales it to the reserved size
+static void fill_from_file(int id, uint8_t *pixels, int width, int height, int stride,
+                           void *data) {
+	(void)id;
+	const char *path = (const char *)data;
+	kinc_mutex_lock(&decode_mutex);
+	size_t size = kinc_image_size_from_file(path);
+	if (size == 0) {
+		kinc_mutex_unlock(&decode_mutex);
+		kinc_log(KINC_LOG_LEVEL_ERROR, "Unable to load image %s", path);
+		return;
+	}
+	// The main thread keeps using kr_malloc, which makes no thread safety guarantees
+	void *memory = malloc(size);
+	assert(memory != NULL);
+	kinc_image_t image;
+	kinc_image_init_from_file(&image, memory, path);
+	kinc_mutex_unlock(&decode_mutex);
+	if (image.format == KINC_IMAGE_FORMAT_RGBA32)
+		krass_pixels_resample(kinc_image_get_pixels(&image), image.width, image.height, pixels,
+		                      width, height, stride);
+	else
+		kinc_log(KINC_LOG_LEVEL_ERROR, "Image %s is not RGBA", path);
+	kinc_mutex_lock(&decode_mutex);
+	kinc_image_destroy(&image);
+	kinc_mutex_unlock(&decode_mutex);
+	free(memory);
+}
+
+// Covers everything that goes into the layout and the pixels, except what callbacks draw
+static uint64_t cache_key(krass_ctx_t *ctx) {
+	uint64_t key = KRASS_CACHE_SEED;
+	krass_canvas_t *canvas = &ctx->canvas;
+	key = krass_cache_hash(key, &ctx->options.cache_version, sizeof(uint32_t));
+	key = krass_cache_hash(key, &canvas->heuristic, sizeof(krass_pack_heuristic_t));
+	key = krass_cache_hash(key, &canvas->sort, sizeof(krass_pack_sort_t));
+	key = krass_cache_hash(key, &canvas->max_size, sizeof(float));
+	key = krass_cache_hash(key, &canvas->trial_heuristics, sizeof(unsigned));
+	key = krass_cache_hash(key, &canvas->trial_sorts, sizeof(unsigned));
+	key = krass_cache_hash(key, &canvas->npot, sizeof(bool));
+	key = krass_cache_hash(key, &ctx->top, sizeof(int));
+	for (int i = 0; i < ctx->top; ++i) {
+		krass_asset_t *asset = &ctx->assets[i];
+		key = krass_cache_hash(key, &asset->type, sizeof(krass_type_t));
+		if (asset->type == KRASS_TYPE_FONT) {
+			krass_font_t *font = &asset->data.font;
+			key = krass_cache_hash(key, font->fontpath, strlen(font->fontpath));
+			key = krass_cache_hash(key, &font->size, sizeof(int));
+			key = krass_cache_hash(key, &font->font_index, sizeof(int));
+			key = krass_cache_hash(key, &font->set.count, sizeof(int));
+			if (font->set.ranges != NULL)
+				key = krass_cache_hash(key, font->set.ranges,
+				                       font->set.count * 2 * sizeof(uint32_t));
+			key = krass_cache_hash(key, &font->spread, sizeof(int));
+			// Glyph cache slots are part of the block of the font
+			if (font->cache != NULL) {
+				key = krass_cache_hash(key, &font->cache->slots.count, sizeof(int));
+				key = krass_cache_hash(key, &font->cache->width, sizeof(int));
+				key = krass_cache_hash(key, &font->cache->height, sizeof(int));
+			}
+			continue;
+		}
+		krass_rect_t *r = &canvas->rects[asset->data.image.pack_id];
+		key = krass_cache_hash(key, &r->w, sizeof(float));
+		key = krass_cache_hash(key, &r->h, sizeof(float));
+		key = krass_cache_hash(key, &r->rotatable, sizeof(bool));
+		bool fill = asset->data.image.fill != NULL;
+		key = krass_cache_hash(key, &fill, sizeof(bool));
+		if (asset->data.image.fill == fill_from_file) {
+			const char *path = (const char *)asset->data.image.data;
+			key = krass_cache_hash(key, path, strlen(path));
+		}
+	}
+	key = krass_cache_hash(key, &ctx->options.premultiply_alpha, sizeof(bool));
+	key = krass_cache_hash(key, &ctx->options.swap_red_blue, sizeof(bool));
+	key = krass_cache_hash(key, &ctx->options.samples, sizeof(int));
+	key = krass_cache_hash(key, &ctx->options.supersample, sizeof(int));
+	return key;
+}
+
+// Spans of the image assets on `page` that are part of the current bake
+static void collect_spans(krass_ctx_t *ctx, int page) {
+	ctx->span_count = 0;
+	ctx->spans = (krass_pixel_span_t *)kr_malloc(
+	    (ctx->top - ctx->dirty > 0 ? ctx->top - ctx->dirty : 1) * sizeof(krass_pixel_span_t));
+	assert(ctx->spans != NULL);
+	for (int id = ctx->dirty; id < ctx->top; ++id) {
+		if (ctx->assets[id].type != KRASS_TYPE_IMAGE) continue;
+		krass_rect_t *r = asset_rect(ctx, id);
+		if (r->page != page) continue;
+		krass_pixel_span_t *span = &ctx->spans[ctx->span_count++];
+		span->x0 = (int)r->x;
+		span->y0 = (int)r->y;
+		span->x1 = span->x0 + (int)ceilf(r->rotated ? r->h : r->w);
+		span->y1 = span->y0 + (int)ceilf(r->rotated ? r->w : r->h);
+		span->alpha_min = 255;
+		span->alpha_max = 0;
+		span->id = id;
+	}
+}
+
+static void store_spans(krass_ctx_t *ctx) {
+	for (int i = 0; i < ctx->span_count; ++i) {
+		krass_image_t *img = &ctx->assets[ctx->spans[i].id].data.image;
+		img->alpha_min = ctx->spans[i].alpha_min;
+		img->alpha_max = ctx->spans[i].alpha_max;
+		img->measured = true;
+	}
+	kr_free(ctx->spans);
+	ctx->spans = NULL;
+	ctx->span_count = 0;
+}
+
+// Whether asset `id` on `page` is drawn from a texture the conversions already ran on, a copy
+// from the previous layout or the previous texture of a page baked in bands
+static bool is_converted(krass_ctx_t *ctx, int id, int page) {
+	krass_asset_t *asset = &ctx->assets[id];
+	// Composited over the copy as the callback filled them
+	if (asset->type == KRASS_TYPE_IMAGE && asset->data.image.pixels != NULL) return false;
+	if (ctx->options.tiled_bake && ctx->pages[page].img != NULL && id < ctx->dirty) return true;
+	if (asset->type != KRASS_TYPE_IMAGE || id >= ctx->prev_top) return false;
+	// Direct pages sample their render target, which was never converted
+	krass_rect_t *src = &ctx->prev_rects[asset->data.image.pack_id];
+	return !ctx->prev_pages[src->page].direct;
+}
+
+// Rects of the assets on `page` that the conversions leave alone, sorted by their left edge
+static void collect_converted(krass_ctx_t *ctx, int page) {
+	ctx->converted_count = 0;
+	ctx->converted =
+	    (krass_pixel_rect_t *)kr_malloc((ctx->top > 0 ? ctx->top : 1) * sizeof(krass_pixel_rect_t));
+	assert(ctx->converted != NULL);
+	for (int id = 0; id < ctx->top; ++id) {
+		krass_rect_t *r = asset_rect(ctx, id);
+		if (r->page != page || !is_converted(ctx, id, page)) continue;
+		krass_pixel_rect_t rect;
+		rect.x0 = (int)r->x;
+		rect.y0 = (int)r->y;
+		rect.x1 = rect.x0 + (int)ceilf(r->rotated ? r->h : r->w);
+		rect.y1 = rect.y0 + (int)ceilf(r->rotated ? r->w : r->h);
+		int k = ctx->converted_count++;
+		for (; k > 0 && ctx->converted[k - 1].x0 > rect.x0; --k)
+			ctx->converted[k] = ctx->converted[k - 1];
+		ctx->converted[k] = rect;
+	}
+}
+
+static void release_converted(krass_ctx_t *ctx) {
+	if (ctx->converted != NULL) kr_free(ctx->converted);
+	ctx->converted = NULL;
+	ctx->converted_count = 0;
+}
+
+static bool load_cache(krass_ctx_t *ctx) {
+	krass_cache_t cache;
+	if (!krass_cache_load(&cache, ctx->options.cache_path, cache_key(ctx), &ctx->canvas))
+		return false;
+	ctx->pixel_bytes += cache.size;
+	if (ctx->pixel_bytes > ctx->peak_bytes) ctx->peak_bytes = ctx->pixel_bytes;
+	ctx->page_count = cache.page_count;
+	ctx->pages = (krass_atlas_page_t *)kr_malloc(ctx->page_count * sizeof(krass_atlas_page_t));
+	assert(ctx->pages != NULL);
+	for (int i = 0; i < ctx->page_count; ++i) {
+		ctx->pages[i].has_target = false;
+		ctx->pages[i].direct = false;
+		// Cached pixels are already converted, only gather the alpha ranges
+		int width = (int)ctx->canvas.pages[i].w;
+		int height = (int)ctx->canvas.pages[i].h;
+		collect_spans(ctx, i);
+		krass_pixels_process(cache.pixels[i], width, height, 0, 0, height, false, NULL,
+		                     ctx->spans, ctx->span_count);
+		store_spans(ctx);
+		ctx->pages[i].img = NULL;
+		ctx->pages[i].copy = NULL;
+		ctx->pages[i].copy_bytes = 0;
+		ctx->pages[i].modified = false;
+		begin_upload(ctx, i);
+		upload_rows(ctx, i, cache.pixels[i], width, 0, height);
+		end_upload(ctx, i);
+		kr_image_generate_mipmaps(ctx->pages[i].img, ctx->mipmap_levels);
+	}
+	ctx->finish_page = ctx->page_count;
+	krass_cache_release(&cache);
+	ctx->pixel_bytes -= cache.size;
+	return true;
+}
+
+#ifndef NDEBUG
+static void write_debug_png(int page, uint8_t *pixels, int width, int height) {
+	char name[32];
+	if (page == 0)
+		strcpy(name, "test.png");
+	else
+		snprintf(name, sizeof(name), "test%d.png", page);
+	stbi_write_png(name, width, height, 4, pixels, width * 4);
+}
+#else
+#define write_debug_png(page, pixels, width, height)
+#endif
+
+static void fill_work(void *param) {
+	krass_fill_pool_t *pool = (krass_fill_pool_t *)param;
+	while (true) {
+		kinc_mutex_lock(&pool->mutex);
+		int i = pool->next++;
+		kinc_mutex_unlock(&pool->mutex);
+		if (i >= pool->count) break;
+		int id = pool->ids[i];
+		krass_image_t *img = &pool->assets[id].data.image;
+		int width = (int)ceilf(img->quad.dim.width);
+		int height = (int)ceilf(img->quad.dim.height);
+		img->fill(id, img->pixels, width, height, width * 4, img->data);
+		kinc_mutex_lock(&pool->mutex);
+		++pool->done;
+		kinc_mutex_unlock(&pool->mutex);
+	}
+}
+
+// Starts the callbacks of the CPU rendered assets in the current bake. Assets copied from previous
+// pages are drawn like any other
+static void begin_fills(krass_ctx_t *ctx) {
+	krass_fill_pool_t *pool = &ctx->fills;
+	pool->count = 0;
+	for (int id = ctx->dirty; id < ctx->top; ++id) {
+		krass_asset_t *asset = &ctx->assets[id];
+		if (asset->type == KRASS_TYPE_IMAGE && asset->data.image.fill != NULL &&
+		    id >= ctx->prev_top)
+			++pool->count;
+	}
+	if (pool->count == 0) return;
+	pool->assets = ctx->assets;
+	pool->ids = (int *)kr_malloc(pool->count * sizeof(int));
+	assert(pool->ids != NULL);
+	pool->next = 0;
+	pool->done = 0;
+	int k = 0;
+	for (int id = ctx->dirty; id < ctx->top; ++id) {
+		krass_image_t *img = &ctx->assets[id].data.image;
+		if (ctx->assets[id].type != KRASS_TYPE_IMAGE || img->fill == NULL || id < ctx->prev_top)
+			continue;
+		size_t bytes = (size_t)ceilf(img->quad.dim.width) * (size_t)ceilf(img->quad.dim.height) * 4;
+		img->pixels = alloc_pixels(ctx, bytes);
+		memset(img->pixels, 0, bytes);
+		pool->ids[k++] = id;
+	}
+	// The calling thread keeps baking
+	int workers = ctx->canvas.threads - 1;
+	if (workers > pool->count) workers = pool->count;
+	if (workers < 1) workers = 1;
+	if (!decode_mutex_ready) {
+		kinc_mutex_init(&decode_mutex);
+		decode_mutex_ready = true;
+	}
+	kinc_mutex_init(&pool->mutex);
+	pool->workers = (kinc_thread_t *)kr_malloc(workers * sizeof(kinc_thread_t));
+	assert(pool->workers != NULL);
+	pool->worker_count = workers;
+	for (int i = 0; i < workers; ++i) kinc_thread_init(&pool->workers[i], fill_work, pool);
+}
+
+// Returns false while callbacks are still running, joins the workers once they are done
+static bool end_fills(krass_fill_pool_t *pool, bool wait) {
+	if (pool->workers == NULL) return true;
+	kinc_mutex_lock(&pool->mutex);
+	bool done = pool->done == pool->count;
+	kinc_mutex_unlock(&pool->mutex);
+	if (!done && !wait) return false;
+	for (int i = 0; i < pool->worker_count; ++i) kinc_thread_wait_and_destroy(&pool->workers[i]);
+	kr_free(pool->workers);
+	kr_free(pool->ids);
+	kinc_mutex_destroy(&pool->mutex);
+	pool->workers = NULL;
+	pool->ids = NULL;
+	return true;
+}
+
+// Copies the rows of CPU rendered assets overlapping the current band into its pixels, which are
+// still upside down if render targets are inverted. The render target never holds them, assets of
+// earlier bakes are copied again whenever their page is baked
+static void composite_band(krass_ctx_t *ctx, int page, int width) {
+	bool flip = kinc_g4_render_targets_inverted_y();
+	for (int id = 0; id < ctx->top; ++id) {
+		krass_image_t *img = &ctx->assets[id].data.image;
+		if (ctx->assets[id].type != KRASS_TYPE_IMAGE || img->pixels == NULL) continue;
+		krass_rect_t *r = asset_rect(ctx, id);
+		if (r->page != page) continue;
+		int x = (int)r->x;
+		int y = (int)r->y;
+		int w = (int)ceilf(r->w);
+		int first = y > ctx->band_row ? y : ctx->band_row;
+		int last = y + (int)ceilf(r->h);
+		if (last > ctx->band_row + ctx->band_rows) last = ctx->band_row + ctx->band_rows;
+		for (int row = first; row < last; ++row) {
+			int dst = flip ? ctx->band_row + ctx->band_rows - 1 - row : row - ctx->band_row;
+			memcpy(ctx->pixels + ((size_t)dst * width + x) * 4, img->pixels + (row - y) * w * 4,
+			       w * 4);
+		}
+	}
+}
+
+static void release_fills(krass_ctx_t *ctx) {
+	for (int id = 0; id < ctx->top; ++id) {
+		krass_image_t *img = &ctx->assets[id].data.image;
+		if (ctx->assets[id].type != KRASS_TYPE_IMAGE || img->pixels == NULL) continue;
+		free_pixels(ctx, img->pixels,
+		            (size_t)ceilf(img->quad.dim.width) * (size_t)ceilf(img->quad.dim.height) * 4);
+		img->pixels = NULL;
+	}
+}
+
+static void next_page(krass_ctx_t *ctx) {
+	++ctx->finish_page;
+	ctx->band_row = 0;
+	ctx->stage = KRASS_STAGE_READBACK;
+}
+
+// Distance fields reach across band borders, pages with such fonts are finished in one band
+static int band_rows(krass_ctx_t *ctx, int page) {
+	int height = (int)ctx->canvas.pages[page].h;
+	int rows = height - ctx->band_row;
+	int band = ctx->options.band_height;
+	return band > 0 && band < rows && !page_has_sdf_font(ctx, page) ? band : rows;
+}
+
+// Turns the baked render targets into textures one stage of one page per tick. Returns true once
+// all pages are done.
+static bool finish_pages(krass_ctx_t *ctx) {
+	if (ctx->finish_page < 0) {
+		if (!end_fills(&ctx->fills, false)) return false;
+		// Only a bake from scratch has every page at hand to write the cache
+		ctx->caching = ctx->dirty == 0 && ctx->options.cache_path != NULL &&
+		               krass_cache_write_begin(&ctx->cache_writer, ctx->options.cache_path,
+		                                       cache_key(ctx), &ctx->canvas);
+		ctx->finish_page = 0;
+		ctx->band_row = 0;
+	}
+	while (ctx->finish_page < ctx->page_count) {
+		int page = ctx->finish_page;
+		krass_atlas_page_t *p = &ctx->pages[page];
+		int width = (int)ctx->canvas.pages[page].w;
+		int height = (int)ctx->canvas.pages[page].h;
+		switch (ctx->stage) {
+		case KRASS_STAGE_READBACK:
+			if (ctx->band_row == 0) {
+				if (p->img != NULL && !page_is_dirty(ctx, page)) {
+					next_page(ctx);
+					continue;
+				}
+				if (p->direct) {
+					if (p->img == NULL) wrap_target(ctx, page);
+					// Read back only to export the cache
+					if (!ctx->caching) {
+						ctx->stage = KRASS_STAGE_MIPMAPS;
+						continue;
+					}
+				}
+				else
+					begin_upload(ctx, page);
+				collect_spans(ctx, page);
+				collect_converted(ctx, page);
+			}
+			ctx->band_rows = band_rows(ctx, page);
+			if (ctx->options.tiled_bake && !render_band(ctx, page)) return false;
+			ctx->pixels = read_band(ctx, page, ctx->band_row, ctx->band_rows);
+			composite_band(ctx, page, width);
+			ctx->processed = 0;
+			ctx->stage = KRASS_STAGE_PROCESS;
+			return false;
+		case KRASS_STAGE_PROCESS:
+			if (ctx->processed < (ctx->band_rows + 1) / 2) {
+				int pairs = KRASS_PROCESS_BYTES / (8 * width);
+				// The render target is sampled as is, so are the cached pixels of direct pages
+				krass_pixel_ops_t ops;
+				ops.premultiply = ctx->options.premultiply_alpha;
+				ops.swap_red_blue = ctx->options.swap_red_blue;
+				ops.skip = ctx->converted;
+				ops.skip_count = ctx->converted_count;
+				ctx->processed = krass_pixels_process(
+				    ctx->pixels, width, ctx->band_rows, ctx->band_row, ctx->processed,
+				    pairs > 1 ? pairs : 1, kinc_g4_render_targets_inverted_y(),
+				    p->direct ? NULL : &ops, ctx->spans, ctx->span_count);
+				return false;
+			}
+			ctx->stage = KRASS_STAGE_UPLOAD;
+			continue;
+		case KRASS_STAGE_UPLOAD:
+			convert_sdf_fonts(ctx, page, ctx->pixels, width);
+			if (ctx->band_rows == height) {
+				write_debug_png(page, ctx->pixels, width, height);
+			}
+			if (!p->direct)
+				upload_rows(ctx, page, ctx->pixels, width, ctx->band_row, ctx->band_rows);
+			if (ctx->caching)
+				krass_cache_write_rows(&ctx->cache_writer, ctx->pixels, width, ctx->band_rows);
+			free_pixels(ctx, ctx->pixels, (size_t)width * ctx->band_rows * 4);
+			ctx->pixels = NULL;
+			ctx->band_row += ctx->band_rows;
+			if (ctx->band_row < height) {
+				ctx->stage = KRASS_STAGE_READBACK;
+				return false;
+			}
+			if (!p->direct) end_upload(ctx, page);
+			store_spans(ctx);
+			release_converted(ctx);
+			ctx->stage = KRASS_STAGE_MIPMAPS;
+			return false;
+		default:
+			if (p->direct)
+				kinc_g4_render_target_generate_mipmaps(&p->target, ctx->mipmap_levels);
+			else
+				kr_image_generate_mipmaps(p->img, ctx->mipmap_levels);
+			next_page(ctx);
+			return false;
+		}
+	}
+	if (ctx->caching) kinc_file_writer_close(&ctx->cache_writer);
+	ctx->caching = false;
+	if (ctx->has_staging) kinc_g4_render_target_destroy(&ctx->staging);
+	ctx->has_staging = false;
+	return true;
+}
+
+// Share of the work after baking that is done, mapping the fonts is the last step
+static float finish_progress(krass_ctx_t *ctx) {
+	if (ctx->cursor > ctx->top) return (float)ctx->page_count / (float)(ctx->page_count + 1);
+	if (ctx->finish_page < 0 || ctx->page_count == 0) return 0.0f;
+	float stage = (float)ctx->stage;
+	if (ctx->stage == KRASS_STAGE_PROCESS && ctx->pixels != NULL) {
+		float pairs = (float)((ctx->band_rows + 1) / 2);
+		stage += pairs > 0.0f ? (float)ctx->processed / pairs : 1.0f;
+	}
+	if (ctx->stage < KRASS_STAGE_MIPMAPS) {
+		// The stages before the mipmaps repeat for every band
+		float height = ctx->canvas.pages[ctx->finish_page].h;
+		float rows = (float)band_rows(ctx, ctx->finish_page);
+		float band = ((float)ctx->band_row + rows * stage / (float)KRASS_STAGE_MIPMAPS) / height;
+		stage = height > 0.0f ? band * (float)KRASS_STAGE_MIPMAPS : 0.0f;
+	}
+	float page = (float)ctx->finish_page + stage / (float)KRASS_STAGE_COUNT;
+	return page / (float)(ctx->page_count + 1);
 }
 
 bool krass_tick(krass_ctx_t *ctx) {
@@ -236,41 +1661,44 @@ bool krass_tick(krass_ctx_t *ctx) {
 		kinc_log(KINC_LOG_LEVEL_ERROR, "Called tick on non finalized context");
 		return true;
 	}
-	if (ctx->cursor - 1 > ctx->top) return false;
-	int width = (int)ctx->canvas.w;
-	int height = (int)ctx->canvas.h;
-	if (ctx->cursor == 0) {
-		kinc_g4_render_target_init_with_multisampling(&ctx->target, width, height,
-		                                              KINC_G4_RENDER_TARGET_FORMAT_32BIT, 16, 0, 1);
-		ctx->first = true;
+	if (!ctx->baking) {
+		if (!ctx->repack && ctx->dirty >= ctx->top) return false;
+		begin_fills(ctx);
+		if (ctx->repack) repack(ctx);
+		ctx->cursor = ctx->dirty;
+		ctx->baking = true;
 	}
+	if (!ctx->bake_started && ctx->cursor == ctx->dirty) begin_bake(ctx);
 	if (ctx->cursor < ctx->top) {
-		kinc_g4_render_target_t *t = {&ctx->target};
-		kinc_g4_set_render_targets(&t, 1);
-		if (ctx->first) {
-			kinc_g4_clear(KINC_G4_CLEAR_COLOR, 0x0, -1, 0);
-			ctx->first = false;
-		}
-		kr_g2_begin(0);
-		kr_g2_set_render_target_dim(width, height);
-		for (int i = 0; i < ctx->step; ++i) {
-			if (ctx->assets[ctx->cursor].type == KRASS_TYPE_FONT)
-				render_font(ctx);
-			else if (ctx->assets[ctx->cursor].type == KRASS_TYPE_IMAGE)
-				render_image(ctx);
+		double start = kinc_time();
+		int bound = -1;
+		for (int i = 0;; ++i) {
+			int id = ctx->order[ctx->cursor];
+			krass_rect_t *r = asset_rect(ctx, id);
+			if (tick_full(ctx, start, i, (double)r->w * (double)r->h)) break;
+			if (r->page != bound) {
+				if (bound > -1) end_page();
+				begin_page(ctx, r->page);
+				bound = r->page;
+			}
+			render_asset(ctx, id, 0.0f);
 			++ctx->cursor;
 			if (ctx->cursor >= ctx->top) break;
 		}
-		kr_g2_reset_render_target_dim();
-		kr_g2_end();
-		kinc_g4_restore_render_target();
+		end_page();
 	}
 	else if (ctx->cursor == ctx->top) {
-		create_texture(ctx);
-		++ctx->cursor;
+		if (finish_pages(ctx)) ++ctx->cursor;
 	}
 	else {
-		map_fonts(ctx);
+		// Fonts only move when everything was baked again
+		if (ctx->dirty == 0) {
+			map_fonts(ctx);
+		}
+		release_previous(ctx);
+		ctx->dirty = ctx->top;
+		ctx->baking = false;
+		ctx->bake_started = false;
 		++ctx->cursor;
 		return false;
 	}
@@ -282,37 +1710,84 @@ float krass_progress(krass_ctx_t *ctx) {
 		kinc_log(KINC_LOG_LEVEL_ERROR, "Called progress on non finalized context");
 		return 0;
 	}
-	return (float)ctx->cursor / (float)(ctx->top + 1);
+	if (!ctx->baking) return 1.0f;
+	float done = (float)ctx->top + finish_progress(ctx);
+	if (ctx->cursor < ctx->top) {
+		// Weighted by pixel area, large assets move the bar further than small ones
+		float baked = ctx->bake_area > 0.0 ? (float)(ctx->baked_area / ctx->bake_area) : 0.0f;
+		done = (float)ctx->dirty + (float)(ctx->top - ctx->dirty) * baked;
+	}
+	return done / (float)(ctx->top + 1);
 }
 
-int krass_reserve_quad(krass_ctx_t *ctx, krass_dim_t dim, krass_draw_callback_t cb, void *data) {
-	if (ctx->cursor > -1) {
-		kinc_log(KINC_LOG_LEVEL_ERROR, "Cannot reserve on finalized context");
+size_t krass_get_peak_memory(krass_ctx_t *ctx) {
+	return ctx->peak_bytes;
+}
+
+static int reserve_quad(krass_ctx_t *ctx, krass_dim_t dim, krass_draw_callback_t cb,
+                        krass_pixels_callback_t fill, void *data, bool rotatable) {
+	if (ctx->baking) {
+		kinc_log(KINC_LOG_LEVEL_ERROR, "Cannot reserve while the context is baking");
 		return -1;
 	}
 	grow_data(ctx);
-	int id = krass_pack_add_rect(&ctx->canvas, dim.width, dim.height);
+	int id = krass_pack_add_rect(&ctx->canvas, dim.width, dim.height, rotatable);
+	if (ctx->cursor > -1 && !ctx->repack && !krass_pack_insert(&ctx->canvas, id))
+		ctx->repack = true;
 	ctx->assets[ctx->top].type = KRASS_TYPE_IMAGE;
 	ctx->assets[ctx->top].data.image.pack_id = id;
 	ctx->assets[ctx->top].data.image.cb = cb;
+	ctx->assets[ctx->top].data.image.fill = fill;
+	ctx->assets[ctx->top].data.image.pixels = NULL;
+	ctx->assets[ctx->top].data.image.measured = false;
 	ctx->assets[ctx->top].data.image.data = data;
 	ctx->assets[ctx->top].data.image.quad.dim.width = dim.width;
 	ctx->assets[ctx->top++].data.image.quad.dim.height = dim.height;
 	return ctx->top - 1;
 }
 
+int krass_reserve_quad(krass_ctx_t *ctx, krass_dim_t dim, krass_draw_callback_t cb, void *data) {
+	return reserve_quad(ctx, dim, cb, NULL, data, false);
+}
+
+int krass_reserve_quad_rotatable(krass_ctx_t *ctx, krass_dim_t dim, krass_draw_callback_t cb,
+                                 void *data) {
+	return reserve_quad(ctx, dim, cb, NULL, data, true);
+}
+
+int krass_reserve_image_file(krass_ctx_t *ctx, const char *path, krass_dim_t dim) {
+	return krass_reserve_pixels(ctx, dim, fill_from_file, (void *)path);
+}
+
+int krass_reserve_pixels(krass_ctx_t *ctx, krass_dim_t dim, krass_pixels_callback_t cb,
+                         void *data) {
+	int id = reserve_quad(ctx, dim, NULL, cb, data, false);
+	// The page it lands on may sample its render target, only a new layout reads it back
+	if (id > -1 && ctx->cursor > -1 && ctx->options.zero_readback) ctx->repack = true;
+	return id;
+}
+
 void krass_draw(krass_ctx_t *ctx, int id, float dx, float dy) {
 	assert(ctx->assets[id].type == KRASS_TYPE_IMAGE);
 	krass_image_t *img = &ctx->assets[id].data.image;
 	krass_rect_t *r = &ctx->canvas.rects[img->pack_id];
-	kr_g2_draw_scaled_sub_image(ctx->img, r->x, r->y, r->w, r->h, dx, dy, r->w, r->h);
+	draw_rect(ctx->pages[r->page].img, r, dx, dy, r->w, r->h);
 }
 
 void krass_draw_scaled(krass_ctx_t *ctx, int id, float dx, float dy, float dw, float dh) {
 	assert(ctx->assets[id].type == KRASS_TYPE_IMAGE);
 	krass_image_t *img = &ctx->assets[id].data.image;
 	krass_rect_t *r = &ctx->canvas.rects[img->pack_id];
-	kr_g2_draw_scaled_sub_image(ctx->img, r->x, r->y, r->w, r->h, dx, dy, dw, dh);
+	draw_rect(ctx->pages[r->page].img, r, dx, dy, dw, dh);
+}
+
+krass_coverage_t krass_get_coverage(krass_ctx_t *ctx, int id) {
+	assert(ctx->assets[id].type == KRASS_TYPE_IMAGE);
+	krass_image_t *img = &ctx->assets[id].data.image;
+	if (!img->measured) return KRASS_COVERAGE_UNKNOWN;
+	if (img->alpha_max == 0) return KRASS_COVERAGE_EMPTY;
+	if (img->alpha_min == 255) return KRASS_COVERAGE_OPAQUE;
+	return KRASS_COVERAGE_TRANSLUCENT;
 }
 
 kr_image_t *krass_get_asset(krass_ctx_t *ctx, int id, krass_quad_t *quad) {
@@ -323,7 +1798,8 @@ kr_image_t *krass_get_asset(krass_ctx_t *ctx, int id, krass_quad_t *quad) {
 	quad->y = r->y;
 	quad->dim.width = r->w;
 	quad->dim.height = r->h;
-	return ctx->img;
+	quad->rotated = r->rotated;
+	return ctx->pages[r->page].img;
 }
 
 #ifdef KR_FULL_RGBA_FONTS
@@ -4,6 +4,8 @@
 #include <krink/image.h>
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 typedef struct krass_ctx krass_ctx_t;
 
@@ -16,8 +18,96 @@ typedef struct krass_quad {
 	float x;
 	float y;
 	krass_dim_t dim;
+	// The asset is stored a quarter turn clockwise, covering `dim.height` x `dim.width` pixels
+	bool rotated;
 } krass_quad_t;
 
+/**
+ * @brief Placement strategy used when packing the reserved quads into the final texture
+ */
+typedef enum krass_pack_heuristic {
+	KRASS_PACK_GUILLOTINE_FIRST_FIT,
+	KRASS_PACK_MAXRECTS_BEST_SHORT_SIDE,
+	KRASS_PACK_MAXRECTS_BEST_LONG_SIDE,
+	KRASS_PACK_MAXRECTS_BEST_AREA,
+	KRASS_PACK_MAXRECTS_BOTTOM_LEFT,
+	KRASS_PACK_MAXRECTS_CONTACT_POINT,
+	KRASS_PACK_SKYLINE_BOTTOM_LEFT,
+	KRASS_PACK_SKYLINE_MIN_WASTE,
+} krass_pack_heuristic_t;
+
+/**
+ * @brief Order in which the reserved quads are handed to the packer, largest first
+ */
+typedef enum krass_pack_sort {
+	KRASS_PACK_SORT_HEIGHT,
+	KRASS_PACK_SORT_WIDTH,
+	KRASS_PACK_SORT_AREA,
+	KRASS_PACK_SORT_PERIMETER,
+	KRASS_PACK_SORT_MAX_SIDE,
+	KRASS_PACK_SORT_HEIGHT_WIDTH,
+} krass_pack_sort_t;
+
+/**
+ * @brief Bit for a `krass_pack_heuristic_t` or `krass_pack_sort_t` in the trial masks of
+ * `krass_options_t`
+ */
+#define KRASS_PACK_TRIAL(value) (1u << (value))
+
+typedef struct krass_options {
+	krass_pack_heuristic_t heuristic;
+	krass_pack_sort_t sort;
+	// Upper bound for either side of the packed texture, set to the device's max texture size.
+	// Assets that do not fit into one texture spill into additional pages
+	int max_size;
+	// Masks of `KRASS_PACK_TRIAL` bits. Every heuristic/sort combination is packed and the
+	// smallest canvas is kept. A zero mask only uses `heuristic` or `sort` respectively
+	unsigned trial_heuristics;
+	unsigned trial_sorts;
+	// Threads running the trials, including the calling thread. 0 uses one per cpu core. Callbacks
+	// of `krass_reserve_pixels` assets run on all but one of them
+	int pack_threads;
+	// Search for the smallest non power of two canvas. Ignored if the device lacks support
+	bool npot;
+	// File in the save directory keeping the baked texture between runs, NULL disables caching.
+	// The cache is used as long as the reserved assets and options stay the same
+	const char *cache_path;
+	// Bump whenever the callbacks draw something different for the same reservations
+	uint32_t cache_version;
+	// Draw from the render targets the assets were baked into instead of reading them back into
+	// textures. Pages holding fonts are still read back, baked fonts need a texture
+	bool zero_readback;
+	// Seconds each `krass_tick` may spend rendering assets, measured per callback. Replaces the
+	// fixed `step` of `krass_init_with_options` when above 0
+	double tick_budget;
+	// Convert the read back pixels before upload. Not applied to `zero_readback` pages
+	bool premultiply_alpha;
+	bool swap_red_blue;
+	// Rows read back and uploaded per band after baking, 0 finishes whole pages at once. Bands
+	// bound the pixel memory of finishing a page regardless of its size. With 0 each page is still
+	// read back in one blocking call, only processing and upload are spread over later ticks
+	int band_height;
+	// Bake every band into one render target of `band_height` rows instead of a render target per
+	// page, bounding render target memory however large the atlas gets. Disables `zero_readback`
+	bool tiled_bake;
+	// Samples per pixel of the render targets assets are baked into, 1 disables multisampling
+	int samples;
+	// Bake at `supersample` times the atlas size and average blocks of `supersample` squared
+	// pixels on the CPU, 1 disables it. Multiplies render target memory by that square, combine
+	// with `tiled_bake` to bound it. Supersampled pages are always read back
+	int supersample;
+} krass_options_t;
+
+/**
+ * @brief Alpha coverage of a baked asset, gathered while the pixels are read back
+ */
+typedef enum krass_coverage {
+	KRASS_COVERAGE_UNKNOWN,
+	KRASS_COVERAGE_EMPTY,
+	KRASS_COVERAGE_OPAQUE,
+	KRASS_COVERAGE_TRANSLUCENT,
+} krass_coverage_t;
+
 /**
  * @brief
  *
@@ -28,6 +118,49 @@ typedef struct krass_quad {
  */
 typedef void (*krass_draw_callback_t)(int id, float x, float y, void *data);
 
+/**
+ * @brief Callback writing the RGBA pixels of an asset reserved with `krass_reserve_pixels`. Runs
+ * on a worker thread while the main thread keeps baking, it must neither call into graphics APIs
+ * nor use kr_malloc
+ *
+ * @param id The id of the asset
+ * @param pixels Top left pixel of the asset, cleared to transparent black
+ * @param width
+ * @param height
+ * @param stride Bytes from one row to the next
+ * @param data
+ */
+typedef void (*krass_pixels_callback_t)(int id, uint8_t *pixels, int width, int height,
+                                        int stride, void *data);
+
+/**
+ * @brief Placement of a glyph written by a `krass_glyph_callback_t`
+ */
+typedef struct krass_glyph_metrics {
+	// Size of the glyph pixels, at most the slot size
+	int width, height;
+	// Offset of the top left pixel from the pen position on the baseline
+	float xoff, yoff;
+	float xadvance;
+} krass_glyph_metrics_t;
+
+/**
+ * @brief Callback rasterizing a glyph into a slot of a glyph cache reserved with
+ * `krass_reserve_glyph_cache`. Runs on a worker thread, it must neither call into graphics APIs
+ * nor use kr_malloc
+ *
+ * @param codepoint
+ * @param pixels Top left pixel of the slot, cleared to transparent black
+ * @param width Width of the slot
+ * @param height Height of the slot
+ * @param stride Bytes from one row to the next
+ * @param metrics Receives the placement of the glyph
+ * @param data
+ * @return true if the font has the glyph
+ */
+typedef bool (*krass_glyph_callback_t)(uint32_t codepoint, uint8_t *pixels, int width, int height,
+                                       int stride, krass_glyph_metrics_t *metrics, void *data);
+
 /**
  * @brief Initialize an empty context
  *
@@ -39,6 +172,26 @@ typedef void (*krass_draw_callback_t)(int id, float x, float y, void *data);
  */
 krass_ctx_t *krass_init(int reserve, int step, int mipmap_levels);
 
+/**
+ * @brief Fill an options struct with the values `krass_init` uses
+ *
+ * @param options
+ */
+void krass_options_set_defaults(krass_options_t *options);
+
+/**
+ * @brief Initialize an empty context with custom options
+ *
+ * @param reserve How many quads to reserve
+ * @param step How many quads to process per call to tick
+ * @param mipmap_levels How many mipmap_levels to generate for the packed texture
+ * @param options Packing options, see `krass_options_set_defaults`
+ *
+ * @return krass_ctx_t*
+ */
+krass_ctx_t *krass_init_with_options(int reserve, int step, int mipmap_levels,
+                                     const krass_options_t *options);
+
 /**
  * @brief Destroy a previously initialized context
  *
@@ -48,12 +201,22 @@ void krass_destroy(krass_ctx_t *ctx);
 
 /**
  * @brief Finalize an asset packing context. Call this after all quads have been reserved using
- * `krass_reserve_quad`
+ * `krass_reserve_quad`. With a valid texture cache no callbacks run and the following
+ * `krass_tick` only needs to map the fonts
  *
  * @param ctx
  */
 void krass_finalize(krass_ctx_t *ctx);
 
+/**
+ * @brief Finalize an asset packing context, then keep searching for a smaller layout until
+ * `budget` seconds have passed since the call. A budget of `0` is the same as `krass_finalize`
+ *
+ * @param ctx
+ * @param budget Time in seconds available for packing
+ */
+void krass_finalize_with_budget(krass_ctx_t *ctx, double budget);
+
 /**
  * @brief Call until it returns `false` after finalizing a context. Needs to be called inside a
  * `kinc_g4_begin/end` block!
@@ -65,7 +228,8 @@ void krass_finalize(krass_ctx_t *ctx);
 bool krass_tick(krass_ctx_t *ctx);
 
 /**
- * @brief Returns a float in the range of 0..1 of the linear progress
+ * @brief Returns a float in the range of 0..1 of the progress, weighted by the pixel area of the
+ * assets baked so far
  *
  * @param ctx
  * @return float
@@ -73,7 +237,19 @@ bool krass_tick(krass_ctx_t *ctx);
 float krass_progress(krass_ctx_t *ctx);
 
 /**
- * @brief Reserve space for an asset
+ * @brief Returns the most bytes of pixel data held in memory at once while finishing pages,
+ * including a loaded texture cache. Copies made by the graphics driver are not included
+ *
+ * @param ctx
+ * @return size_t
+ */
+size_t krass_get_peak_memory(krass_ctx_t *ctx);
+
+/**
+ * @brief Reserve space for an asset. After a finalized context finished baking, the asset is
+ * placed into the free space of the existing texture and only its callback runs during the next
+ * calls to `krass_tick`. If it does not fit, the next `krass_tick` calls repack the whole texture,
+ * copying the previously baked assets from the old one. Cannot be called while baking.
  *
  * @param ctx
  * @param dim The size of the asset
@@ -83,6 +259,47 @@ float krass_progress(krass_ctx_t *ctx);
  */
 int krass_reserve_quad(krass_ctx_t *ctx, krass_dim_t dim, krass_draw_callback_t cb, void *data);
 
+/**
+ * @brief Same as `krass_reserve_quad`, but the packer may store the asset a quarter turn clockwise
+ * when that fits better. The callback still draws the asset upright, `krass_draw` and
+ * `krass_draw_scaled` turn it back and `krass_get_asset` reports the rotation
+ *
+ * @param ctx
+ * @param dim The size of the asset
+ * @param cb Callback function that draws the asset into a rendertarget
+ * @param data User data that gets passed into the callback
+ * @return int The id of the asset in the final texture
+ */
+int krass_reserve_quad_rotatable(krass_ctx_t *ctx, krass_dim_t dim, krass_draw_callback_t cb,
+                                 void *data);
+
+/**
+ * @brief Reserve space for an asset rendered on the CPU. Callbacks of all such assets run in
+ * parallel on worker threads while the other assets bake, their pixels are copied into the atlas
+ * as is, without blending. The pixels stay in memory until the context is destroyed, later bakes
+ * of the same page copy them again. Draw it like any other asset
+ *
+ * @param ctx
+ * @param dim The size of the asset, rounded up to whole pixels
+ * @param cb Callback function that writes the pixels of the asset
+ * @param data User data that gets passed into the callback
+ * @return int The id of the asset in the final texture
+ */
+int krass_reserve_pixels(krass_ctx_t *ctx, krass_dim_t dim, krass_pixels_callback_t cb,
+                         void *data);
+
+/**
+ * @brief Reserve space for an image file, decoded on a worker thread while packing and scaled to
+ * `dim` with bilinear filtering. No texture of the file is ever created, the scaled pixels are
+ * kept like those of `krass_reserve_pixels` and the file is decoded only once
+ *
+ * @param ctx
+ * @param path Path of an RGBA image, has to stay valid until the context is destroyed
+ * @param dim The size of the asset in the final texture
+ * @return int The id of the asset in the final texture
+ */
+int krass_reserve_image_file(krass_ctx_t *ctx, const char *path, krass_dim_t dim);
+
 /**
  * @brief Draw a specific asset. This is expected to be called inside a `kr_g2_begin/_end` block
  *
@@ -107,7 +324,8 @@ void krass_draw(krass_ctx_t *ctx, int id, float dx, float dy);
 void krass_draw_scaled(krass_ctx_t *ctx, int id, float dx, float dy, float dw, float dh);
 
 /**
- * @brief Retrieve the krink image and get the source quad data of a specific asset
+ * @brief Retrieve the krink image and get the source quad data of a specific asset. When the assets
+ * span multiple pages, this is the image of the page holding the asset
  *
  * @param ctx
  * @param id The id of the asset
@@ -116,6 +334,16 @@ void krass_draw_scaled(krass_ctx_t *ctx, int id, float dx, float dy, float dw, f
  */
 kr_image_t *krass_get_asset(krass_ctx_t *ctx, int id, krass_quad_t *quad);
 
+/**
+ * @brief Retrieve the alpha coverage of a baked asset, e.g. to skip empty assets or draw opaque
+ * ones without blending. Assets on `zero_readback` pages that were never read back are unknown
+ *
+ * @param ctx
+ * @param id The id of the asset
+ * @return krass_coverage_t
+ */
+krass_coverage_t krass_get_coverage(krass_ctx_t *ctx, int id);
+
 /**
  * @brief Reserve space for a baked, full RGBA font. Only available when the `KR_FULL_RGBA_FONTS`
  * macro is defined
@@ -128,6 +356,63 @@ kr_image_t *krass_get_asset(krass_ctx_t *ctx, int id, krass_quad_t *quad);
  */
 int krass_reserve_quad_font(krass_ctx_t *ctx, const char *fontpath, int size, int font_index);
 
+/**
+ * @brief Reserve space for a baked, full RGBA font that only packs the glyphs of the given
+ * codepoint ranges. Only available when the `KR_FULL_RGBA_FONTS` macro is defined
+ *
+ * @param ctx
+ * @param fontpath
+ * @param size
+ * @param font_index
+ * @param ranges Pairs of first and last codepoint, inclusive. Copied
+ * @param range_count Number of pairs in `ranges`
+ * @return int The id of the asset or `-1` if the `KR_FULL_RGBA_FONTS` macro is undefined
+ */
+int krass_reserve_quad_font_ranges(krass_ctx_t *ctx, const char *fontpath, int size,
+                                   int font_index, const uint32_t *ranges, int range_count);
+
+/**
+ * @brief Reserve space for a baked, full RGBA font that only packs the glyphs used by `text`,
+ * e.g. every string of the app. Control characters are skipped. Only available when the
+ * `KR_FULL_RGBA_FONTS` macro is defined
+ *
+ * @param ctx
+ * @param fontpath
+ * @param size
+ * @param font_index
+ * @param text UTF-8 encoded, only read during the call
+ * @return int The id of the asset or `-1` if the `KR_FULL_RGBA_FONTS` macro is undefined
+ */
+int krass_reserve_quad_font_text(krass_ctx_t *ctx, const char *fontpath, int size,
+                                 int font_index, const char *text);
+
+/**
+ * @brief Bake a reserved font as a signed distance field that can be drawn at any size, instead
+ * of its coverage at one size. The alpha channel holds the field: 0.5 on the outline, 1 at
+ * `spread` pixels of the baked size inside it and 0 as far outside, colors are white or equal
+ * to alpha with `premultiply_alpha`. Draw the quads of `krass_get_glyph_scaled` with a shader
+ * that thresholds alpha at 0.5 and smooths by its screen space derivative. A glyph cache of the
+ * font has to write fields with the same `spread`. Pages holding such fonts are finished in one
+ * band. Only available when the `KR_FULL_RGBA_FONTS` macro is defined
+ *
+ * @param ctx Not finalized yet
+ * @param id The id of the font
+ * @param spread Falloff of the field in pixels, also the empty margin around every glyph. A size
+ * of 32 to 64 with a spread of 4 to 8 suits most text
+ * @return true if the font is baked as a distance field
+ */
+bool krass_set_font_sdf(krass_ctx_t *ctx, int id, int spread);
+
+/**
+ * @brief Number of requested codepoints the baked font of a subset reservation does not provide.
+ * They are logged as well and known once the context is finalized
+ *
+ * @param ctx
+ * @param id
+ * @return int
+ */
+int krass_get_missing_glyphs(krass_ctx_t *ctx, int id);
+
 /**
  * @brief Retrieve the baked font with the corresponding id. Only available when the
  * `KR_FULL_RGBA_FONTS` macro is defined
@@ -137,3 +422,63 @@ int krass_reserve_quad_font(krass_ctx_t *ctx, const char *fontpath, int size, in
  * @return kr_ttf_font_t* The baked font or `NULL` if the `KR_FULL_RGBA_FONTS` macro is undefined
  */
 kr_ttf_font_t *krass_get_font(krass_ctx_t *ctx, int id);
+
+/**
+ * @brief Reserve slots for glyphs rasterized at runtime next to the baked glyphs of a font, for
+ * glyph sets too large to bake ahead like CJK or user input. Glyphs are rasterized by `cb` when
+ * first asked for and the least recently used one is evicted once all slots are taken. Only
+ * available when the `KR_FULL_RGBA_FONTS` macro is defined
+ *
+ * @param ctx Not finalized yet
+ * @param id The id of the font
+ * @param slot Size of a slot, fitting the largest glyph
+ * @param slots Number of slots
+ * @param cb
+ * @param data User data that gets passed into the callback
+ * @return true if the cache was reserved
+ */
+bool krass_reserve_glyph_cache(krass_ctx_t *ctx, int id, krass_dim_t slot, int slots,
+                               krass_glyph_callback_t cb, void *data);
+
+/**
+ * @brief Retrieve the quad of a glyph like `kr_ttf_get_baked_quad`, taken from the baked glyphs
+ * or the glyph cache of the font. Both are sampled from `kr_ttf_get_texture` of the font. Glyphs
+ * not in the cache yet are queued and only available after a later `krass_update_glyphs`. Only
+ * available when the `KR_FULL_RGBA_FONTS` macro is defined
+ *
+ * @param ctx
+ * @param id The id of the font
+ * @param codepoint
+ * @param quad Filled with the screen and texture coordinates of the glyph
+ * @param x Pen position
+ * @param y Baseline
+ * @return true if the glyph can be drawn
+ */
+bool krass_get_glyph(krass_ctx_t *ctx, int id, uint32_t codepoint, kr_ttf_aligned_quad_t *quad,
+                     float x, float y);
+
+/**
+ * @brief Same as `krass_get_glyph`, with the quad scaled from the baked size of the font to
+ * `size` and not snapped to whole pixels. Meant for fonts baked as distance fields
+ *
+ * @param ctx
+ * @param id The id of the font
+ * @param codepoint
+ * @param quad Filled with the screen and texture coordinates of the glyph
+ * @param x Pen position
+ * @param y Baseline
+ * @param size Pixel size to draw the glyph at
+ * @return true if the glyph can be drawn
+ */
+bool krass_get_glyph_scaled(krass_ctx_t *ctx, int id, uint32_t codepoint,
+                            kr_ttf_aligned_quad_t *quad, float x, float y, float size);
+
+/**
+ * @brief Rasterizes the glyphs queued by `krass_get_glyph` on a worker thread and uploads those
+ * that are done. Call once per frame before drawing text, does nothing while the context bakes.
+ * Without a region update in g4, a page holding glyph caches keeps a copy of its pixels in memory
+ * and is uploaded as a whole
+ *
+ * @param ctx
+ */
+void krass_update_glyphs(krass_ctx_t *ctx);
@@ -1,5 +1,6 @@
 #include <kinc/graphics4/graphics.h>
 #include <kinc/graphics4/rendertarget.h>
+#include <kinc/log.h>
 #include <kinc/system.h>
 #include <krink/graphics2/graphics.h>
 #include <krink/graphics2/ttf.h>
@@ -10,6 +11,7 @@
 
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 
 #ifdef NDEBUG
 #define STB_IMAGE_WRITE_IMPLEMENTATION
@@ -21,6 +23,17 @@
 #define FONT_SIZE 24
 #define FONT_PATH "B612Mono-Regular.ttf"
 #define IMAGE_PATH "tex.k"
+// Too small for all assets, the atlas spills into a second page
+#define MAX_SIZE 256
+#define BAR_WIDTH 96
+#define BAR_HEIGHT 24
+// A block this wide leaves the bar room only when it is turned
+#define ROTATE_SIZE 128
+#define BLOCK_WIDTH 100
+#define GRADIENT_SIZE 32
+#define PROBE_SIZE 16
+// Translucent and red unlike blue, converting it twice shows
+#define PROBE_COLOR 0x80ff4010
 
 enum asset_name {
 	CIRCLE0 = 0,
@@ -32,6 +45,8 @@ enum asset_name {
 	IMAGE1,
 	IMAGE2,
 	IMAGE3,
+	BAR,
+	GRADIENT,
 	FONT,
 	ASSET_COUNT
 };
@@ -69,8 +84,139 @@ static void create_png(kinc_g4_render_target_t *target) {
 	kr_free(data);
 }
 
+// GPU-free checks of the internal modules in internal.c
+bool run_internal_tests(void);
+
+static void check(bool ok, const char *message) {
+	if (ok) return;
+	kinc_log(KINC_LOG_LEVEL_ERROR, "%s", message);
+	exit(EXIT_FAILURE);
+}
+
+// The bar and the gradient are only verified, drawing them would change the compared image
+static void check_assets(void) {
+	krass_quad_t quad;
+	kr_image_t *first = krass_get_asset(krass_ctx, assets[CIRCLE0], &quad);
+	bool spilled = false;
+	for (int i = CIRCLE0; i < FONT; ++i)
+		if (krass_get_asset(krass_ctx, assets[i], &quad) != first) spilled = true;
+	check(spilled, "All assets fit into one page despite the maximum size");
+	krass_get_asset(krass_ctx, assets[BAR], &quad);
+	check(quad.dim.width == BAR_WIDTH && quad.dim.height == BAR_HEIGHT,
+	      "The rotatable asset lost its upright size");
+	check(krass_get_coverage(krass_ctx, assets[BAR]) == KRASS_COVERAGE_OPAQUE,
+	      "The rotatable asset was not baked");
+	krass_get_asset(krass_ctx, assets[GRADIENT], &quad);
+	check(quad.dim.width == GRADIENT_SIZE && quad.dim.height == GRADIENT_SIZE && !quad.rotated,
+	      "The CPU filled asset has the wrong size");
+	check(krass_get_coverage(krass_ctx, assets[GRADIENT]) == KRASS_COVERAGE_OPAQUE,
+	      "The CPU filled asset was not copied into the atlas");
+}
+
+static void probe_cb(int id, float x, float y, void *data) {
+	kr_g2_set_color(PROBE_COLOR);
+	kr_g2_fill_rect(x, y, PROBE_SIZE, PROBE_SIZE);
+}
+
+// Center pixel of the asset drawn into a render target of its size
+static uint32_t read_probe(krass_ctx_t *ctx, int id) {
+	kinc_g4_render_target_t target;
+	kinc_g4_render_target_init(&target, PROBE_SIZE, PROBE_SIZE, KINC_G4_RENDER_TARGET_FORMAT_32BIT,
+	                           0, 0);
+	kinc_g4_render_target_t *targets = {&target};
+	kinc_g4_set_render_targets(&targets, 1);
+	kinc_g4_clear(KINC_G4_CLEAR_COLOR, 0, 0, 0);
+	kr_g2_begin(0);
+	kr_g2_set_render_target_dim(PROBE_SIZE, PROBE_SIZE);
+	kr_g2_set_color(0xffffffff);
+	krass_draw(ctx, id, 0, 0);
+	kr_g2_reset_render_target_dim();
+	kr_g2_end();
+	uint8_t pixels[PROBE_SIZE * PROBE_SIZE * 4];
+	kinc_g4_render_target_get_pixels(&target, pixels);
+	kinc_g4_restore_render_target();
+	kinc_g4_render_target_destroy(&target);
+	uint32_t color;
+	memcpy(&color, &pixels[(PROBE_SIZE / 2 * PROBE_SIZE + PROBE_SIZE / 2) * 4], 4);
+	return color;
+}
+
+// A baked asset keeps its colour when its page is baked again with the conversions on, either on
+// top of its previous texture in a tiled bake or copied into a new layout
+static void check_conversions(bool tiled) {
+	krass_options_t options;
+	krass_options_set_defaults(&options);
+	options.premultiply_alpha = true;
+	options.swap_red_blue = true;
+	options.tiled_bake = tiled;
+	krass_ctx_t *ctx = krass_init_with_options(2, 1, 1, &options);
+	krass_dim_t dim = {.width = PROBE_SIZE, .height = PROBE_SIZE};
+	int probe = krass_reserve_quad(ctx, dim, probe_cb, NULL);
+	krass_finalize(ctx);
+	while (krass_tick(ctx)) {}
+	uint32_t before = read_probe(ctx, probe);
+	// A small asset fits next to the probe, a large one needs a new layout
+	float size = tiled ? 4 : 4 * PROBE_SIZE;
+	krass_reserve_quad(ctx, (krass_dim_t){.width = size, .height = size}, probe_cb, NULL);
+	while (krass_tick(ctx)) {}
+	check(read_probe(ctx, probe) == before, tiled ? "Baking a tiled page again changed its colors"
+	                                              : "Copying into a new layout changed colors");
+	krass_destroy(ctx);
+}
+
+static void bar_cb(int id, float x, float y, void *data);
+
+// The bar only fits next to the block turned a quarter
+static void check_rotation(void) {
+	krass_options_t options;
+	krass_options_set_defaults(&options);
+	options.max_size = ROTATE_SIZE;
+	krass_ctx_t *ctx = krass_init_with_options(2, 1, 1, &options);
+	krass_reserve_quad(ctx, (krass_dim_t){.width = BLOCK_WIDTH, .height = ROTATE_SIZE - 1},
+	                   probe_cb, NULL);
+	int bar = krass_reserve_quad_rotatable(
+	    ctx, (krass_dim_t){.width = BAR_WIDTH, .height = BAR_HEIGHT}, bar_cb, NULL);
+	krass_finalize(ctx);
+	while (krass_tick(ctx)) {}
+	krass_quad_t quad;
+	krass_get_asset(ctx, bar, &quad);
+	check(quad.rotated, "The rotatable asset was not turned to fit");
+	check(quad.dim.width == BAR_WIDTH && quad.dim.height == BAR_HEIGHT,
+	      "The turned asset lost its upright size");
+	check(krass_get_coverage(ctx, bar) == KRASS_COVERAGE_OPAQUE, "The turned asset was not baked");
+	krass_destroy(ctx);
+}
+
+static void probe_fill(int id, uint8_t *pixels, int width, int height, int stride, void *data) {
+	for (int y = 0; y < height; ++y) memset(&pixels[y * stride], 0xc0, width * 4);
+}
+
+// CPU filled assets survive a later bake of their page, the render target never held them
+static void check_incremental_fill(void) {
+	krass_options_t options;
+	krass_options_set_defaults(&options);
+	krass_ctx_t *ctx = krass_init_with_options(3, 1, 1, &options);
+	krass_dim_t dim = {.width = PROBE_SIZE, .height = PROBE_SIZE};
+	int probe = krass_reserve_pixels(ctx, dim, probe_fill, NULL);
+	int file = krass_reserve_image_file(ctx, IMAGE_PATH, dim);
+	krass_finalize(ctx);
+	while (krass_tick(ctx)) {}
+	uint32_t before = read_probe(ctx, probe);
+	uint32_t file_before = read_probe(ctx, file);
+	krass_reserve_quad(ctx, (krass_dim_t){.width = 4, .height = 4}, probe_cb, NULL);
+	while (krass_tick(ctx)) {}
+	check(read_probe(ctx, probe) == before, "Baking a page again lost its CPU filled asset");
+	check(read_probe(ctx, file) == file_before, "Baking a page again lost its image file");
+	krass_destroy(ctx);
+}
+
 static void update(void *unused) {
+	check_assets();
 	kinc_g4_begin(0);
+	check_conversions(true);
+	check_conversions(false);
+	check_incremental_fill();
+	check_rotation();
 	kinc_g4_render_target_t target;
 	kinc_g4_render_target_init(&target, WINDOW_WIDTH, WINDOW_HEIGHT,
 	                           KINC_G4_RENDER_TARGET_FORMAT_32BIT, 16, 0);
@@ -136,17 +282,37 @@ static void image_cb(int id, float x, float y, void *data) {
 	kr_g2_draw_scaled_sub_image(&image, sx, sy, 512, 512, x, y, 128, 128);
 }
 
+static void bar_cb(int id, float x, float y, void *data) {
+	kr_g2_set_color(0xffffffff);
+	kr_g2_fill_rect(x, y, BAR_WIDTH, BAR_HEIGHT);
+}
+
+static void gradient_cb(int id, uint8_t *pixels, int width, int height, int stride, void *data) {
+	for (int y = 0; y < height; ++y)
+		for (int x = 0; x < width; ++x) {
+			uint8_t *p = &pixels[y * stride + x * 4];
+			p[0] = (uint8_t)(x * 255 / (width - 1));
+			p[1] = (uint8_t)(y * 255 / (height - 1));
+			p[2] = 0;
+			p[3] = 255;
+		}
+}
+
 int kickstart(int argc, char **argv) {
 	kinc_init("krass basic", WINDOW_WIDTH, WINDOW_HEIGHT, NULL, NULL);
 	kinc_set_update_callback(pre_update, NULL);
 
 	void *mem = malloc(10 * 1024 * 1024);
 	kr_init(mem, 10 * 1024 * 1024, NULL, 0);
+	check(run_internal_tests(), "The internal checks failed");
 	kr_g2_init();
 	kr_image_init(&image);
 	kr_image_load(&image, IMAGE_PATH, false);
 	kr_image_generate_mipmaps(&image, 30);
-	krass_ctx = krass_init(15, 2, 30);
+	krass_options_t options;
+	krass_options_set_defaults(&options);
+	options.max_size = MAX_SIZE;
+	krass_ctx = krass_init_with_options(15, 2, 30, &options);
 	for (int i = 0; i < 5; ++i)
 		assets[CIRCLE0 + i] = krass_reserve_quad(
 		    krass_ctx, (krass_dim_t){.width = 32, .height = 32}, circle_cb, &colors[i]);
@@ -154,6 +320,11 @@ int kickstart(int argc, char **argv) {
 		assets[IMAGE0 + i] = krass_reserve_quad(
 		    krass_ctx, (krass_dim_t){.width = 128, .height = 128}, image_cb, (void *)(uint64_t)i);
 
+	assets[BAR] = krass_reserve_quad_rotatable(
+	    krass_ctx, (krass_dim_t){.width = BAR_WIDTH, .height = BAR_HEIGHT}, bar_cb, NULL);
+	assets[GRADIENT] = krass_reserve_pixels(
+	    krass_ctx, (krass_dim_t){.width = GRADIENT_SIZE, .height = GRADIENT_SIZE}, gradient_cb,
+	    NULL);
 	assets[FONT] = krass_reserve_quad_font(krass_ctx, FONT_PATH, FONT_SIZE, 0);
 
 	krass_finalize(krass_ctx);
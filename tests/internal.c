@@ -0,0 +1,269 @@
+#include <internal/cache.c.h>
+#include <internal/glyphs.c.h>
+#include <internal/pack.c.h>
+#include <internal/pixels.c.h>
+
+#include <kinc/log.h>
+#include <krink/memory.h>
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Checks of the packer, the texture cache, the glyph sets and slots and the distance fields that
+// need no GPU. The basic test runs them before it bakes anything
+
+#define CACHE_PATH "krass_internal.cache"
+#define RECT_COUNT 120
+
+static int failures = 0;
+
+static void expect(bool ok, const char *what) {
+	if (ok) return;
+	kinc_log(KINC_LOG_LEVEL_ERROR, "Internal check failed: %s", what);
+	++failures;
+}
+
+static unsigned rng;
+
+static unsigned next_random(void) {
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return rng;
+}
+
+// Deterministic mix of small, wide and rotatable rects
+static void add_rects(krass_canvas_t *canvas, int count) {
+	rng = 12345;
+	for (int i = 0; i < count; ++i) {
+		float w = (float)(4 + next_random() % 60);
+		float h = (float)(4 + next_random() % (i % 3 == 0 ? 12 : 60));
+		krass_pack_add_rect(canvas, w, h, i % 4 == 0);
+	}
+}
+
+static float stored_w(const krass_rect_t *r) {
+	return ceilf(r->rotated ? r->h : r->w);
+}
+
+static float stored_h(const krass_rect_t *r) {
+	return ceilf(r->rotated ? r->w : r->h);
+}
+
+// Every rect lies on a page, within its bounds and apart from the others
+static bool valid_layout(const krass_canvas_t *canvas) {
+	for (int i = 0; i < canvas->top; ++i) {
+		const krass_rect_t *a = &canvas->rects[i];
+		if (a->page < 0 || a->page >= canvas->page_count || a->x < 0.0f || a->y < 0.0f)
+			return false;
+		if (a->rotated && !a->rotatable) return false;
+		const krass_page_t *page = &canvas->pages[a->page];
+		if (a->x + stored_w(a) > page->w || a->y + stored_h(a) > page->h) return false;
+		for (int j = i + 1; j < canvas->top; ++j) {
+			const krass_rect_t *b = &canvas->rects[j];
+			if (a->page == b->page && a->x < b->x + stored_w(b) && b->x < a->x + stored_w(a) &&
+			    a->y < b->y + stored_h(b) && b->y < a->y + stored_h(a))
+				return false;
+		}
+	}
+	return true;
+}
+
+static bool same_layout(const krass_canvas_t *a, const krass_canvas_t *b) {
+	if (a->top != b->top || a->page_count != b->page_count) return false;
+	for (int i = 0; i < a->page_count; ++i)
+		if (a->pages[i].w != b->pages[i].w || a->pages[i].h != b->pages[i].h) return false;
+	for (int i = 0; i < a->top; ++i) {
+		const krass_rect_t *p = &a->rects[i];
+		const krass_rect_t *q = &b->rects[i];
+		if (p->x != q->x || p->y != q->y || p->w != q->w || p->h != q->h || p->page != q->page ||
+		    p->rotated != q->rotated)
+			return false;
+	}
+	return true;
+}
+
+static void check_pack(void) {
+	krass_canvas_t single;
+	krass_pack_init(&single, RECT_COUNT);
+	single.max_size = 256.0f;
+	single.trial_heuristics = KRASS_PACK_TRIAL(KRASS_PACK_MAXRECTS_BEST_SHORT_SIDE) |
+	                          KRASS_PACK_TRIAL(KRASS_PACK_SKYLINE_BOTTOM_LEFT) |
+	                          KRASS_PACK_TRIAL(KRASS_PACK_GUILLOTINE_FIRST_FIT);
+	single.trial_sorts =
+	    KRASS_PACK_TRIAL(KRASS_PACK_SORT_HEIGHT) | KRASS_PACK_TRIAL(KRASS_PACK_SORT_AREA);
+	add_rects(&single, RECT_COUNT);
+	krass_pack_compute(&single, 0.0);
+	expect(valid_layout(&single), "packed rects overlap or leave their page");
+	expect(single.page_count > 1, "rects past max_size did not spill into another page");
+
+	krass_canvas_t threaded;
+	krass_pack_init(&threaded, RECT_COUNT);
+	threaded.max_size = single.max_size;
+	threaded.trial_heuristics = single.trial_heuristics;
+	threaded.trial_sorts = single.trial_sorts;
+	threaded.threads = 4;
+	add_rects(&threaded, RECT_COUNT);
+	krass_pack_compute(&threaded, 0.0);
+	expect(same_layout(&single, &threaded), "the layout depends on the number of threads");
+	krass_pack_destroy(&threaded);
+
+	// A rect placed into the remaining space keeps the others where they are and satisfies the
+	// same invariants as a full pack of the same input
+	krass_canvas_t repacked;
+	krass_pack_init(&repacked, RECT_COUNT + 1);
+	repacked.max_size = single.max_size;
+	add_rects(&repacked, RECT_COUNT);
+	krass_pack_add_rect(&repacked, 3.0f, 3.0f, false);
+	krass_pack_compute(&repacked, 0.0);
+	expect(valid_layout(&repacked), "a full pack with the extra rect is invalid");
+	krass_rect_t *before = (krass_rect_t *)kr_malloc(single.top * sizeof(krass_rect_t));
+	memcpy(before, single.rects, single.top * sizeof(krass_rect_t));
+	int id = krass_pack_add_rect(&single, 3.0f, 3.0f, false);
+	expect(krass_pack_insert(&single, id), "a small rect found no free space");
+	expect(single.top == repacked.top, "insert and repack hold different rect counts");
+	expect(valid_layout(&single), "an inserted rect overlaps or leaves its page");
+	bool kept = true;
+	for (int i = 0; i < id; ++i)
+		kept = kept && before[i].x == single.rects[i].x && before[i].y == single.rects[i].y &&
+		       before[i].page == single.rects[i].page;
+	expect(kept, "inserting moved rects that were placed before");
+	kr_free(before);
+	krass_pack_destroy(&repacked);
+	krass_pack_destroy(&single);
+}
+
+static void write_cache(krass_canvas_t *canvas, uint64_t key, int pages) {
+	kinc_file_writer_t writer;
+	if (!krass_cache_write_begin(&writer, CACHE_PATH, key, canvas)) return;
+	for (int i = 0; i < pages; ++i) {
+		int width = (int)canvas->pages[i].w;
+		int height = (int)canvas->pages[i].h;
+		uint8_t *pixels = (uint8_t *)kr_malloc((size_t)width * height * 4);
+		memset(pixels, i + 1, (size_t)width * height * 4);
+		krass_cache_write_rows(&writer, pixels, width, height);
+		kr_free(pixels);
+	}
+	kinc_file_writer_close(&writer);
+}
+
+static void check_cache(void) {
+	krass_canvas_t canvas;
+	krass_pack_init(&canvas, RECT_COUNT);
+	canvas.max_size = 256.0f;
+	add_rects(&canvas, RECT_COUNT);
+	krass_pack_compute(&canvas, 0.0);
+	krass_canvas_t loaded;
+	krass_pack_init(&loaded, RECT_COUNT);
+	add_rects(&loaded, RECT_COUNT);
+	krass_cache_t cache;
+
+	write_cache(&canvas, 42, canvas.page_count);
+	expect(!krass_cache_load(&cache, CACHE_PATH, 43, &loaded), "a stale cache was accepted");
+	expect(krass_cache_load(&cache, CACHE_PATH, 42, &loaded), "a valid cache was rejected");
+	if (cache.file != NULL) {
+		expect(same_layout(&canvas, &loaded), "the cached layout differs");
+		bool pixels = cache.page_count == canvas.page_count;
+		for (int i = 0; pixels && i < cache.page_count; ++i)
+			pixels = cache.pixels[i][0] == i + 1;
+		expect(pixels, "the cached pixels differ");
+		krass_cache_release(&cache);
+	}
+
+	// The last page is missing
+	write_cache(&canvas, 42, canvas.page_count - 1);
+	expect(!krass_cache_load(&cache, CACHE_PATH, 42, &loaded), "a truncated cache was accepted");
+
+	krass_pack_add_rect(&loaded, 8.0f, 8.0f, false);
+	write_cache(&canvas, 42, canvas.page_count);
+	expect(!krass_cache_load(&cache, CACHE_PATH, 42, &loaded),
+	       "a cache of fewer rects was accepted");
+	krass_pack_destroy(&loaded);
+	krass_pack_destroy(&canvas);
+}
+
+static void check_glyph_sets(void) {
+	uint32_t ranges[] = {100, 120, 40, 50, 51, 60, 200, 190, 0x10fff0, 0x20ffff, 110, 130};
+	krass_glyph_set_t set;
+	krass_glyphs_set_ranges(&set, ranges, 6);
+	uint32_t merged[] = {40, 60, 100, 130, 0x10fff0, KRASS_GLYPHS_LAST};
+	expect(set.count == 3 && memcmp(set.ranges, merged, sizeof(merged)) == 0,
+	       "ranges are not sorted, merged and clamped");
+	expect(internal_glyphs_contains(&set, 55) && !internal_glyphs_contains(&set, 61) &&
+	           !internal_glyphs_contains(&set, 195),
+	       "set lookup is wrong");
+	kr_free(set.ranges);
+
+	uint32_t c[5];
+	const char *text = "a\xc3\xa4\xe2\x82\xac\xf0\x9f\x98\x80\xff";
+	for (int i = 0; i < 5; ++i) text = internal_glyphs_decode(text, &c[i]);
+	expect(c[0] == 'a' && c[1] == 0xe4 && c[2] == 0x20ac && c[3] == 0x1f600 && c[4] == 0xfffd &&
+	           *text == 0,
+	       "UTF-8 is decoded wrong");
+
+	krass_glyph_set_t used;
+	krass_glyphs_set_text(&used, "ba\nab\t~");
+	uint32_t chars[] = {'a', 'b', '~', '~'};
+	expect(used.count == 2 && memcmp(used.ranges, chars, sizeof(chars)) == 0,
+	       "text sets keep control characters or duplicates");
+	uint32_t first = 0;
+	expect(krass_glyphs_missing(&used, '~' - KRASS_GLYPHS_FIRST, &first) == 1 && first == '~',
+	       "missing glyphs are counted wrong");
+	kr_free(used.ranges);
+}
+
+static void check_glyph_slots(void) {
+	krass_glyph_slots_t s;
+	krass_glyph_slots_init(&s, 3);
+	int a = krass_glyph_slots_acquire(&s, 'a');
+	int b = krass_glyph_slots_acquire(&s, 'b');
+	int c = krass_glyph_slots_acquire(&s, 'c');
+	expect(a != b && b != c && a != c, "glyphs share a slot");
+	expect(krass_glyph_slots_acquire(&s, 'd') == -1, "a glyph of the current frame was evicted");
+	++s.frame;
+	expect(krass_glyph_slots_acquire(&s, 'a') == a, "a cached glyph moved");
+	// b is the least recently used glyph now, then c
+	expect(krass_glyph_slots_acquire(&s, 'd') == b, "the eviction skipped the oldest glyph");
+	expect(krass_glyph_slots_acquire(&s, 'e') == c, "the eviction order is wrong");
+	expect(krass_glyph_slots_acquire(&s, 'a') == a && krass_glyph_slots_acquire(&s, 'd') == b,
+	       "recently used glyphs were evicted");
+	krass_glyph_slots_destroy(&s);
+}
+
+static void check_sdf(void) {
+	// Inside left of the edge at `edge`, pixel centers are half a pixel away from it
+	enum { width = 16, height = 4, edge = 8, spread = 4 };
+	uint8_t pixels[width * height * 4];
+	memset(pixels, 0, sizeof(pixels));
+	for (int y = 0; y < height; ++y)
+		for (int x = 0; x < edge; ++x) pixels[(y * width + x) * 4 + 3] = 255;
+	float *scratch = (float *)kr_malloc(krass_pixels_sdf_scratch(width, height) * sizeof(float));
+	krass_pixels_sdf(pixels, width * 4, 0, 0, width, height, spread, true, scratch);
+	kr_free(scratch);
+	bool exact = true;
+	bool premultiplied = true;
+	for (int x = 0; x < width; ++x) {
+		float distance = (float)(edge - x) - 0.5f;
+		float expected = 127.5f + distance * 127.5f / (float)spread;
+		expected = expected < 0.0f ? 0.0f : expected > 255.0f ? 255.0f : expected;
+		for (int y = 0; y < height; ++y) {
+			const uint8_t *p = &pixels[(y * width + x) * 4];
+			exact = exact && fabsf(p[3] - expected) <= 1.0f;
+			premultiplied = premultiplied && p[0] == p[3] && p[1] == p[3] && p[2] == p[3];
+		}
+	}
+	expect(exact, "distance field values are off");
+	expect(premultiplied, "premultiplied distance field colors differ from alpha");
+}
+
+bool run_internal_tests(void) {
+	failures = 0;
+	check_pack();
+	check_cache();
+	check_glyph_sets();
+	check_glyph_slots();
+	check_sdf();
+	return failures == 0;
+}